@@ -1,5 +1,7 @@
 #include <sys/errno.h>
 #include <sys/lock.h>
+#include <time.h>
+#include "sdkconfig.h"
 #include "littlefs/lfs.h" 
 #include "vfs/vfs_littlefs.h" 
 
@@ -11,6 +13,14 @@
 
 static char used[MAX_FILES] = {0};
 static struct lfs_file files[MAX_FILES] = {0};
+static struct lfs_file_config cfgs[MAX_FILES] = {0};
+#if CONFIG_LFS_FILE_EXTENTS > 0
+static struct lfs_extent extents[MAX_FILES][CONFIG_LFS_FILE_EXTENTS];
+#endif
+#if CONFIG_LFS_MTIME
+static int64_t mtimes[MAX_FILES];
+static struct lfs_attr attrs[MAX_FILES];
+#endif
 static _lock_t lock = {0};
 static char has_init = 0;
 
@@ -43,6 +53,60 @@ struct lfs_file *esp_lfs_fd_file(int fd)
     return NULL;
 }
 
+const struct lfs_file_config *esp_lfs_fd_config(int fd, uint32_t cache_size,
+        bool (*direct)(const void *buffer), bool mtime)
+{
+    int i = DEC(fd);
+    if (VALID(i)) {
+        cfgs[i].cache_size = cache_size;
+        cfgs[i].direct = direct;
+#if CONFIG_LFS_FILE_EXTENTS > 0
+        cfgs[i].extents = extents[i];
+        cfgs[i].extent_count = CONFIG_LFS_FILE_EXTENTS;
+#endif
+#if CONFIG_LFS_MTIME
+        attrs[i].type = ESP_LFS_ATTR_MTIME;
+        attrs[i].buffer = &mtimes[i];
+        attrs[i].size = sizeof(mtimes[i]);
+        cfgs[i].attrs = &attrs[i];
+        cfgs[i].attr_count = mtime ? 1 : 0;
+#else
+        (void) mtime;
+#endif
+        return &cfgs[i];
+    }
+    errno = EBADF;
+    return NULL;
+}
+
+int64_t *esp_lfs_fd_mtime(int fd)
+{
+#if CONFIG_LFS_MTIME
+    int i = DEC(fd);
+    if (VALID(i)) {
+        return &mtimes[i];
+    }
+#else
+    (void) fd;
+#endif
+    return NULL;
+}
+
+void esp_lfs_fd_touch(int fd)
+{
+#if CONFIG_LFS_MTIME
+    int i = DEC(fd);
+    if (VALID(i)) {
+        mtimes[i] = time(NULL);
+        /* littlefs reads the attributes when it commits the file, so this
+         * only costs a commit if the file is dirty anyway */
+        cfgs[i].attr_count = 1;
+    }
+#else
+    (void) fd;
+#endif
+}
+
 int esp_lfs_fd_close(int fd)
 {
     int i = DEC(fd);
@@ -82,7 +82,11 @@ esp_err_t vfs_littlefs_sdmmc_mount(
 
     print_card_infos(card);
 
-    cfg = lfs_setup_sdmmc(card);
+    if (flags & LFS_FLAG_AUTOTUNE) {
+        cfg = lfs_setup_sdmmc_tuned(card, flags & LFS_FLAG_FORMAT);
+    } else {
+        cfg = lfs_setup_sdmmc(card);
+    }
     if (!cfg) {
         ESP_LOGE(TAG, "lfs_setup_sdmmc fail");
         err = -1;
@@ -90,6 +94,17 @@ esp_err_t vfs_littlefs_sdmmc_mount(
     }
 
     err = esp_vfs_littlefs_mount(base_path, cfg, flags);
+    if (err < 0 && (flags & LFS_FLAG_AUTOTUNE) && !(flags & LFS_FLAG_FORMAT)) {
+        // only read the superblock when the default block size is wrong
+        struct lfs_config *stored = lfs_setup_sdmmc_stored(card);
+        if (stored && stored->block_size != cfg->block_size) {
+            lfs_setup_sdmmc_cleanup(cfg);
+            cfg = stored;
+            err = esp_vfs_littlefs_mount(base_path, cfg, flags);
+        } else if (stored) {
+            lfs_setup_sdmmc_cleanup(stored);
+        }
+    }
     if (err < 0) {
         ESP_LOGE(TAG, "esp_vfs_littlefs_mount fail");
         err = -1;
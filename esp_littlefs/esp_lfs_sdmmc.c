@@ -4,6 +4,8 @@
 #include "esp_log.h"
 #include "esp_compiler.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_idf_version.h"
 #include "driver/sdmmc_types.h"
 #include "sdmmc_cmd.h" // components/sdmmc/include/sdmmc_cmd.h
 #include "littlefs/lfs.h"
@@ -24,6 +26,7 @@ typedef struct lfs_sdmmc_ctx_s {
     _lock_t lock;
 #endif
     sdmmc_card_t *card;
+    struct lfs_sdmmc_tuning tuning;
 } lfs_sdmmc_ctx_t;
 
 static enum lfs_error conv_err(esp_err_t e)
@@ -127,7 +130,18 @@ static size_t find_gcd(size_t a, size_t b)
     return a;
 }
 
-struct lfs_config *lfs_setup_sdmmc(sdmmc_card_t *card)
+/* smallest read and program sizes the card can do */
+static void min_io_size(sdmmc_card_t *card, size_t *rd, size_t *pg)
+{
+    *rd = 1 << card->csd.read_block_len;
+    *pg = card->csd.sector_size;
+
+    while (*rd < 128) *rd <<= 1;
+    while (*pg < 128) *pg <<= 1;
+}
+
+static struct lfs_config *setup_sdmmc(sdmmc_card_t *card,
+        size_t rd, size_t pg, size_t bs, size_t cs, size_t la)
 {
     struct lfs_config *c = malloc(sizeof(*c));
     lfs_sdmmc_ctx_t *ctx = malloc(sizeof(*ctx));
@@ -154,23 +168,39 @@ struct lfs_config *lfs_setup_sdmmc(sdmmc_card_t *card)
     _lock_init(&ctx->lock);
 #endif
 
-    size_t rd = 1 << card->csd.read_block_len;
-    size_t pg = card->csd.sector_size;
-
-    while (rd < 128) rd <<= 1;
-    while (pg < 128) pg <<= 1;
-
-    size_t ideal_block_size = 8192;
-    size_t bs = rd * pg / find_gcd(rd, pg);
-    while (bs < ideal_block_size) { bs <<= 1; }
-
     c->read_size = rd;
     c->prog_size = pg;
     c->block_size = bs;
-    c->block_count = card->csd.capacity * card->csd.sector_size / bs;
+    c->block_count = (uint64_t) card->csd.capacity * card->csd.sector_size / bs;
     c->block_cycles = 347; // block-level wear leveling parameter
-    c->cache_size = bs;
-    c->lookahead_size = 256; // multiple of 8
+    c->cache_size = cs;
+    c->lookahead_size = la; // multiple of 8
+#if defined(CONFIG_LFS_VERIFY_ALWAYS)
+    c->verify = LFS_VERIFY_ALWAYS;
+#elif defined(CONFIG_LFS_VERIFY_SAMPLED)
+    c->verify = LFS_VERIFY_SAMPLED;
+#elif defined(CONFIG_LFS_VERIFY_NEVER)
+    c->verify = LFS_VERIFY_NEVER;
+#else
+    c->verify = LFS_VERIFY_METADATA;
+#endif
+    /* compacted pairs hold at most half a block, so no more is ever used */
+    c->compact_size = CONFIG_LFS_COMPACT_SIZE < bs / 2
+        ? CONFIG_LFS_COMPACT_SIZE : bs / 2;
+    /* index the last pair looked into, that's most of them for stat/open */
+    c->index_size = CONFIG_LFS_INDEX_SIZE < bs / 2
+        ? CONFIG_LFS_INDEX_SIZE : bs / 2;
+    /* parents of pairs, so wear relocations don't walk the card */
+    c->parent_size = CONFIG_LFS_PARENT_SIZE;
+#if CONFIG_LFS_PACK_FILES
+    /* small files share blocks, up to what fits in a file's cache */
+    c->pack_max = cs;
+#endif
+#if CONFIG_LFS_FILE_POOL > 0
+    /* sector sized buffers for readers, set aside at mount */
+    c->file_pool_count = CONFIG_LFS_FILE_POOL;
+    c->file_pool_size = rd > pg ? rd : pg;
+#endif
 
     if (1) {
         c->read_buffer = heap_caps_malloc(c->cache_size, MALLOC_CAP_DMA);
@@ -179,20 +209,256 @@ struct lfs_config *lfs_setup_sdmmc(sdmmc_card_t *card)
         if (c->prog_buffer) ESP_LOGI(TAG, "Alloc'd a DMA-capable write cache");
     }
 
+    ctx->tuning.block_size = bs;
+    ctx->tuning.cache_size = cs;
+    ctx->tuning.lookahead_size = la;
+
     ESP_LOGI(TAG, "Read size: %d", (int) rd);
     ESP_LOGI(TAG, "Program size: %d", (int) pg);
     ESP_LOGI(TAG, "Block size: %d", (int) bs);
     ESP_LOGI(TAG, "Block count: %d", (int) c->block_count);
+    ESP_LOGI(TAG, "Cache size: %d", (int) cs);
+    ESP_LOGI(TAG, "Lookahead size: %d", (int) la);
+
+    return c;
+}
+
+struct lfs_config *lfs_setup_sdmmc(sdmmc_card_t *card)
+{
+    size_t rd, pg;
+    min_io_size(card, &rd, &pg);
+
+    size_t ideal_block_size = 8192;
+    size_t bs = rd * pg / find_gcd(rd, pg);
+    while (bs < ideal_block_size) { bs <<= 1; }
+
+    return setup_sdmmc(card, rd, pg, bs, bs, 256);
+}
+
+/* Autotuning. SDHC cards report 512 byte sectors whatever their flash looks
+ * like, so the block size is picked by timing writes of each candidate size,
+ * and the cache size by timing reads. The smallest size within
+ * TUNE_GOOD_ENOUGH percent of the best throughput wins, small blocks waste
+ * less space on small files and metadata. */
+#define TUNE_MIN_BLOCK 4096
+#define TUNE_MAX_BLOCK 65536
+#define TUNE_MAX_CACHE 16384
+#define TUNE_MAX_LOOKAHEAD 2048
+#define TUNE_PROBE_BYTES (256*1024) // per candidate
+#define TUNE_GOOD_ENOUGH 90
+
+/* allocation unit in bytes from the SD status, 0 if unknown */
+static uint32_t card_au_size(const sdmmc_card_t *card)
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    return card->ssr.alloc_unit_kb * 1024;
+#else
+    (void) card;
+    return 0;
+#endif
+}
+
+/* Block size of the superblock starting at byte offset off, 0 if there is
+ * none. The superblock name tag is always the first tag in its block,
+ * followed by the inline-struct tag (see SPEC.md), so this works without
+ * knowing the geometry. */
+static size_t superblock_at(sdmmc_card_t *card, uint8_t *buf, size_t off,
+        uint32_t *rev)
+{
+    size_t ss = card->csd.sector_size;
+    if (off + ss > (uint64_t) card->csd.capacity * ss
+            || sdmmc_read_sectors(card, buf, off / ss, 1) != ESP_OK
+            || memcmp(&buf[8], "littlefs", 8) != 0) {
+        return 0;
+    }
+    uint32_t tag, size;
+    memcpy(&tag, &buf[4], 4);
+    tag = lfs_frombe32(tag) ^ 0xffffffff;
+    memcpy(&size, &buf[16], 4);
+    tag ^= lfs_frombe32(size);
+    memcpy(&size, &buf[24], 4);
+    size = lfs_fromle32(size);
+    if ((tag & 0x80000000)
+            || ((tag >> 20) & 0x7ff) != LFS_TYPE_INLINESTRUCT
+            || (tag & 0x3ff) != 24
+            || size < ss || size % ss != 0) {
+        return 0;
+    }
+    memcpy(rev, &buf[0], 4);
+    *rev = lfs_fromle32(*rev);
+    return size;
+}
+
+/* Block size of the filesystem already on the card, 0 if there is none.
+ * Either block of the superblock pair may hold the latest copy, and block 1
+ * sits at the block size, so every power of two offset is tried for a copy
+ * that agrees with where it was found. The higher revision wins. */
+static size_t stored_block_size(sdmmc_card_t *card)
+{
+    size_t ss = card->csd.sector_size;
+    uint8_t *buf = heap_caps_malloc(ss, MALLOC_CAP_DMA);
+    if (!buf) {
+        return 0;
+    }
+    uint32_t best, rev;
+    size_t bs = superblock_at(card, buf, 0, &best);
+    for (size_t size = ss; size <= TUNE_MAX_BLOCK; size <<= 1) {
+        if (superblock_at(card, buf, size, &rev) == size
+                && (!bs || (int32_t) (rev - best) > 0)) {
+            bs = size;
+            best = rev;
+        }
+    }
+    heap_caps_free(buf);
+    return bs;
+}
+
+/* throughput in kB/s of moving TUNE_PROBE_BYTES in transfers of size,
+ * starting at byte offset start. 0 on error */
+static uint32_t probe(sdmmc_card_t *card, bool write, size_t start,
+        size_t size)
+{
+    size_t ss = card->csd.sector_size;
+    uint8_t *buf = heap_caps_malloc(size, MALLOC_CAP_DMA);
+    if (!buf) {
+        return 0;
+    }
+    memset(buf, 0xff, size);
 
+    int64_t t = esp_timer_get_time();
+    for (size_t off = 0; off < TUNE_PROBE_BYTES; off += size) {
+        esp_err_t e = write
+            ? sdmmc_write_sectors(card, buf, (start + off) / ss, size / ss)
+            : sdmmc_read_sectors(card, buf, (start + off) / ss, size / ss);
+        if (e != ESP_OK) {
+            heap_caps_free(buf);
+            return 0;
+        }
+    }
+    t = esp_timer_get_time() - t;
+    heap_caps_free(buf);
+
+    // bytes per ms, near enough kB/s
+    return (uint64_t) TUNE_PROBE_BYTES * 1000 / (t > 0 ? t : 1);
+}
+
+/* time each power of two size in [min, max], return the smallest that is
+ * good enough */
+static size_t probe_sizes(sdmmc_card_t *card, bool write,
+        size_t min, size_t max, uint32_t *kbps)
+{
+    uint32_t speed[16] = {0};
+    uint32_t best = 0;
+    size_t n = 0;
+    for (size_t size = min; size <= max && n < 16; size <<= 1, ++n) {
+        // separate regions for writes, in case the card caches the last one
+        speed[n] = probe(card, write, write ? n * TUNE_PROBE_BYTES : 0, size);
+        ESP_LOGD(TAG, "%s %d bytes: %u kB/s", write ? "write" : "read",
+                (int) size, (unsigned) speed[n]);
+        best = speed[n] > best ? speed[n] : best;
+    }
+
+    size_t size = min;
+    for (size_t i = 0; i < n; ++i, size <<= 1) {
+        if ((uint64_t) speed[i] * 100 >= (uint64_t) best * TUNE_GOOD_ENOUGH) {
+            *kbps = speed[i];
+            return size;
+        }
+    }
+    *kbps = 0;
+    return min;
+}
+
+/* stored is the block size already on the card, 0 to pick one */
+static struct lfs_config *setup_tuned(sdmmc_card_t *card, bool format,
+        size_t stored)
+{
+    size_t rd, pg;
+    min_io_size(card, &rd, &pg);
+    size_t io = rd * pg / find_gcd(rd, pg);
+    uint64_t capacity = (uint64_t) card->csd.capacity * card->csd.sector_size;
+    uint32_t au = card_au_size(card);
+    uint32_t write_kbps = 0, read_kbps = 0;
+
+    size_t max_bs = TUNE_MAX_BLOCK;
+    if (au && au < max_bs) {
+        max_bs = au;
+    }
+    size_t min_bs = io > TUNE_MIN_BLOCK ? io : TUNE_MIN_BLOCK;
+    if (max_bs < min_bs) {
+        max_bs = min_bs;
+    }
+
+    size_t bs = stored;
+    if (format) {
+        // the probe needs its own region per candidate
+        size_t n = 0;
+        for (size_t size = min_bs; size <= max_bs; size <<= 1) n++;
+        if ((uint64_t) n * TUNE_PROBE_BYTES <= capacity) {
+            bs = probe_sizes(card, true, min_bs, max_bs, &write_kbps);
+        }
+    }
+    if (!bs) {
+        bs = min_bs;
+        while (bs < 8192 && bs < max_bs) { bs <<= 1; }
+    }
+
+    size_t cs = io;
+    size_t max_cs = bs < TUNE_MAX_CACHE ? bs : TUNE_MAX_CACHE;
+    if (TUNE_PROBE_BYTES <= capacity) {
+        cs = probe_sizes(card, false, io, max_cs, &read_kbps);
+    }
+
+    // enough lookahead to cover the card, within reason
+    uint64_t blocks = capacity / bs;
+    size_t la = (blocks / 8 + 7) & ~(size_t) 7;
+    if (la < 32) la = 32;
+    if (la > TUNE_MAX_LOOKAHEAD) la = TUNE_MAX_LOOKAHEAD;
+
+    struct lfs_config *c = setup_sdmmc(card, rd, pg, bs, cs, la);
+    if (c) {
+        lfs_sdmmc_ctx_t *ctx = c->context;
+        ctx->tuning.au_size = au;
+        ctx->tuning.write_kbps = write_kbps;
+        ctx->tuning.read_kbps = read_kbps;
+        ESP_LOGI(TAG, "Tuned for AU %u: block %d (%u kB/s write), "
+                "cache %d (%u kB/s read), lookahead %d",
+                (unsigned) au, (int) bs, (unsigned) write_kbps,
+                (int) cs, (unsigned) read_kbps, (int) la);
+    }
     return c;
 }
 
+struct lfs_config *lfs_setup_sdmmc_tuned(sdmmc_card_t *card, bool format)
+{
+    return setup_tuned(card, format, 0);
+}
+
+struct lfs_config *lfs_setup_sdmmc_stored(sdmmc_card_t *card)
+{
+    size_t bs = stored_block_size(card);
+    if (!bs) {
+        ESP_LOGW(TAG, "no littlefs superblock found");
+        return NULL;
+    }
+    return setup_tuned(card, false, bs);
+}
+
+const struct lfs_sdmmc_tuning *lfs_sdmmc_tuning(const struct lfs_config *c)
+{
+    lfs_sdmmc_ctx_t *ctx = c->context;
+    return &ctx->tuning;
+}
+
 void lfs_setup_sdmmc_cleanup(struct lfs_config *c)
 {
-#ifdef LFS_THREADSAFE
     lfs_sdmmc_ctx_t *ctx = c->context;
+#ifdef LFS_THREADSAFE
     _lock_close(&ctx->lock);
 #endif
+    heap_caps_free(c->read_buffer);
+    heap_caps_free(c->prog_buffer);
+    free(ctx);
     free(c);
 }
 
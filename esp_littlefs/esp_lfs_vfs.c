@@ -2,8 +2,16 @@
 #include <sys/fcntl.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <time.h>
+#include "sdkconfig.h"
 #include "esp_vfs.h"
 #include "esp_log.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_memory_utils.h"
+#else
+#include "soc/soc_memory_layout.h"
+#endif
 #include "littlefs/lfs.h"
 #include "vfs/vfs_littlefs.h"
 
@@ -13,10 +21,29 @@ typedef struct vlfs_ctx_s {
     lfs_t lfs; // first member has to be lfs
 } vlfs_ctx_t;
 
+/* directory entries decoded per lfs_dir_readbatch call, each is an lfs_info
+ * held in every open directory */
+#define VLFS_DIR_BATCH CONFIG_LFS_DIR_BATCH
+/* telldir locations remembered per directory, so seekdir can go straight
+ * back to them; older ones are walked to from the first entry */
+#define VLFS_DIR_MARKS CONFIG_LFS_DIR_MARKS
+
+typedef struct vlfs_dir_mark_s {
+    long loc; // -1 if unused
+    lfs_dir_cursor_t cursor;
+    uint8_t skip; // entries into the batch read from cursor
+} vlfs_dir_mark_t;
+
 typedef struct vlfs_dir_s {
     DIR newlib_d;
     lfs_dir_t lfs_d;
     struct dirent de;
+    struct lfs_info batch[VLFS_DIR_BATCH];
+    lfs_dir_cursor_t batch_cursor; // where batch was read from
+    uint8_t batch_len; // entries in batch
+    uint8_t batch_pos; // next entry to return
+    vlfs_dir_mark_t marks[VLFS_DIR_MARKS];
+    uint8_t next_mark;
 } vlfs_dir_t;
 
 #define vlfs_file_p(ctx, fd) esp_lfs_fd_file(fd)
@@ -51,13 +78,21 @@ static int vlfs_set_errno(int e) {
     return 0;
 }
 
+/* The sdmmc driver bounces buffers it can not DMA to or from sector by
+ * sector, so littlefs only transfers straight to and from the user's buffer
+ * if it is DMA-capable and word aligned. Others go through the caches. */
+static bool vlfs_direct(const void *buf)
+{
+    return esp_ptr_dma_capable(buf) && ((uintptr_t) buf & 3) == 0;
+}
+
 static int vlfs_open(void *ctx, const char *path, int flags, int mode)
 {
-    int lflags = 0;
+    int lflags = LFS_O_DIRECT;
     switch(flags & O_ACCMODE) {
-        case O_RDONLY: lflags = LFS_O_RDONLY; break;
-        case O_WRONLY: lflags = LFS_O_WRONLY; break;
-        case O_RDWR: lflags = LFS_O_RDWR; break;
+        case O_RDONLY: lflags |= LFS_O_RDONLY; break;
+        case O_WRONLY: lflags |= LFS_O_WRONLY; break;
+        case O_RDWR: lflags |= LFS_O_RDWR; break;
         default: errno = EINVAL; return -1;
     }
     const int fd = esp_lfs_fd_new();
@@ -70,12 +105,40 @@ static int vlfs_open(void *ctx, const char *path, int flags, int mode)
     if (flags & O_EXCL) lflags |= LFS_O_EXCL;
     if (flags & O_TRUNC) lflags |= LFS_O_TRUNC;
     if (flags & O_APPEND) lflags |= LFS_O_APPEND;
+#if CONFIG_LFS_APPEND_LOG
+    if (flags & O_APPEND) lflags |= LFS_O_LOG;
+#endif
     ESP_LOGI(TAG, "open(path=%s, flags=0x%x, mode=0x%0x) lflags=0x%x", path, flags, mode, lflags);
-    int err = lfs_file_open(ctx, vlfs_file_p(ctx, fd), path, lflags);
+    int64_t *mtime = esp_lfs_fd_mtime(fd);
+    bool stamp = false; /* whether opening changes the file */
+    if (mtime) {
+        *mtime = 0; /* left alone if the file has no mtime yet */
+    }
+    if (mtime && (lflags & LFS_O_WRONLY)) {
+        /* writers only load the mtime attribute when opening creates or
+         * truncates the file, as it's committed again on close. Otherwise
+         * it waits for the first write, so opening and closing a file
+         * without writing costs no commit */
+        int res = (flags & O_TRUNC) ? LFS_ERR_NOENT : lfs_getattr(ctx, path,
+                ESP_LFS_ATTR_MTIME, mtime, sizeof(*mtime));
+        stamp = res == LFS_ERR_NOENT;
+    }
+    /* readers take a small buffer from the pool, if the mount has one */
+    const struct lfs_config *cfg = ((lfs_t*) ctx)->cfg;
+    uint32_t cache_size = (cfg->file_pool_count
+            && (lflags & ~LFS_O_DIRECT) == LFS_O_RDONLY)
+            ? cfg->file_pool_size : 0;
+    int err = lfs_file_opencfg(ctx, vlfs_file_p(ctx, fd), path, lflags,
+            esp_lfs_fd_config(fd, cache_size, vlfs_direct,
+                stamp || !(lflags & LFS_O_WRONLY)));
     if (err) {
+        esp_lfs_fd_close(fd);
         errno = vlfs_tr_error(err);
         return -1;
     }
+    if (stamp) {
+        esp_lfs_fd_touch(fd);
+    }
     return fd;
 }
 
@@ -85,6 +148,7 @@ static int vlfs_close(void *ctx, int fd)
     if (f) {
         int err = lfs_file_close(ctx, f);
         memset(f, 0, sizeof(*f));
+        esp_lfs_fd_close(fd);
         return vlfs_set_errno(err);
     }
     return -1;
@@ -110,6 +174,7 @@ static ssize_t vlfs_write(void *ctx, int fd, const void *src, size_t size)
     lfs_file_t *f = vlfs_file_p(ctx, fd); if (!f) { return -1; }
     ssize_t bytes = lfs_file_write(ctx, f, src, size);
     if (bytes < 0) { errno = vlfs_tr_error(bytes); return -1; }
+    esp_lfs_fd_touch(fd);
     return bytes;
 }
 #endif
@@ -145,15 +210,26 @@ off_t vlfs_lseek(void *ctx, int fd, off_t offset, int mode)
     return new_pos;
 }
 
-static void fill_info(struct lfs_info *info, struct stat *st)
+/* ino_t is 16 bits in newlib, fold the upper half in rather than drop it */
+static ino_t vlfs_ino(uint32_t ino)
 {
+    return sizeof(ino_t) < sizeof(ino) ? (ino_t) (ino ^ (ino >> 16)) : ino;
+}
+
+/* blksize is the cache size of the open file, or 0 for the mount's */
+static void fill_info(void *ctx, const struct lfs_info *info, int64_t mtime,
+        lfs_size_t blksize, struct stat *st)
+{
+    const struct lfs_config *cfg = ((lfs_t*) ctx)->cfg;
     memset(st, 0, sizeof(*st));
     st->st_size = info->size;
-    st->st_ino = 123;
+    st->st_ino = vlfs_ino(info->ino);
     st->st_nlink = 1;
     //st->st_dev = 1234;
-    //st->st_blksize = TODO;
-    //st->st_blocks = TODO;
+    /* transfers of a whole cache or more skip the caches */
+    st->st_blksize = blksize ? blksize : cfg->cache_size;
+    st->st_blocks = (uint64_t) info->blocks * cfg->block_size / 512;
+    st->st_mtime = st->st_atime = st->st_ctime = mtime;
     st->st_mode = S_IRWXU | S_IRWXG | S_IRWXO;
     switch (info->type) {
         case LFS_TYPE_REG: st->st_mode |= S_IFREG; break;
@@ -170,7 +246,28 @@ int vlfs_stat(void *ctx, const char *path, struct stat *st)
         errno = vlfs_tr_error(err);
         return -1;
     }
-    fill_info(&info, st);
+    int64_t mtime = 0;
+#if CONFIG_LFS_MTIME
+    if (info.type == LFS_TYPE_REG && lfs_getattr(ctx, path,
+                ESP_LFS_ATTR_MTIME, &mtime, sizeof(mtime)) != sizeof(mtime)) {
+        mtime = 0;
+    }
+#endif
+    fill_info(ctx, &info, mtime, 0, st);
+    return 0;
+}
+
+static int vlfs_fstat(void *ctx, int fd, struct stat *st)
+{
+    lfs_file_t *f = vlfs_file_p(ctx, fd); if (!f) { return -1; }
+    struct lfs_info info;
+    int err = lfs_file_stat(ctx, f, &info);
+    if (err < 0) {
+        errno = vlfs_tr_error(err);
+        return -1;
+    }
+    int64_t *mtime = esp_lfs_fd_mtime(fd);
+    fill_info(ctx, &info, mtime ? *mtime : 0, f->cache.buffer_size, st);
     return 0;
 }
 
@@ -194,29 +291,128 @@ DIR* vlfs_opendir(void *ctx, const char *path)
         errno = vlfs_tr_error(err);
         return NULL;
     }
+    d->batch_len = d->batch_pos = 0;
+    for (int i = 0; i < VLFS_DIR_MARKS; ++i) {
+        d->marks[i].loc = -1;
+    }
+    d->next_mark = 0;
     return (DIR*) d;
 }
 
-struct dirent* vlfs_readdir(void *ctx, DIR *newlib_d)
+/* fill the batch from the current position, returns entries read */
+static int vlfs_dir_fill(void *ctx, vlfs_dir_t *d)
 {
-    vlfs_dir_t *d = (vlfs_dir_t*) newlib_d;
-    struct lfs_info info;
-    int err = lfs_dir_read(ctx, &d->lfs_d, &info);
+    d->batch_len = d->batch_pos = 0;
+    int err = lfs_dir_tellcursor(ctx, &d->lfs_d, &d->batch_cursor);
     if (err < 0) {
-        errno = vlfs_tr_error(err);
-        return NULL;
+        return err;
     }
-    if (err == 0) {
-        /* end of directory */
-        return NULL;
+    int n = lfs_dir_readbatch(ctx, &d->lfs_d, d->batch, VLFS_DIR_BATCH);
+    if (n > 0) {
+        d->batch_len = n;
     }
-    d->de.d_ino = 0;
-    d->de.d_type = info.type == LFS_TYPE_REG ? DT_REG : DT_DIR;
-    strncpy(d->de.d_name, info.name, LFS_NAME_MAX < 255 ? LFS_NAME_MAX : 255);
+    return n;
+}
+
+struct dirent* vlfs_readdir(void *ctx, DIR *newlib_d)
+{
+    vlfs_dir_t *d = (vlfs_dir_t*) newlib_d;
+    if (d->batch_pos == d->batch_len) {
+        int n = vlfs_dir_fill(ctx, d);
+        if (n < 0) {
+            errno = vlfs_tr_error(n);
+            return NULL;
+        }
+        if (n == 0) {
+            /* end of directory */
+            return NULL;
+        }
+    }
+    const struct lfs_info *info = &d->batch[d->batch_pos++];
+    d->de.d_ino = vlfs_ino(info->ino);
+    d->de.d_type = info->type == LFS_TYPE_REG ? DT_REG : DT_DIR;
+    strncpy(d->de.d_name, info->name, LFS_NAME_MAX < 255 ? LFS_NAME_MAX : 255);
     d->de.d_name[255] = '\0';
     return &d->de;
 }
 
+int vlfs_readdir_r(void *ctx, DIR *newlib_d, struct dirent *entry,
+        struct dirent **out_dirent)
+{
+    int saved_errno = errno;
+    errno = 0;
+    struct dirent *de = vlfs_readdir(ctx, newlib_d);
+    int err = errno;
+    errno = saved_errno;
+    if (!de) {
+        /* err is 0 at the end of directory */
+        *out_dirent = NULL;
+        return err;
+    }
+    memcpy(entry, de, sizeof(*entry));
+    *out_dirent = entry;
+    return 0;
+}
+
+long vlfs_telldir(void *ctx, DIR *newlib_d)
+{
+    vlfs_dir_t *d = (vlfs_dir_t*) newlib_d;
+    vlfs_dir_mark_t m;
+    if (d->batch_pos < d->batch_len) {
+        /* part way through the batch */
+        m.cursor = d->batch_cursor;
+        m.skip = d->batch_pos;
+    } else {
+        int err = lfs_dir_tellcursor(ctx, &d->lfs_d, &m.cursor);
+        if (err < 0) {
+            errno = vlfs_tr_error(err);
+            return -1;
+        }
+        m.skip = 0;
+    }
+    m.loc = (long) m.cursor.pos + m.skip;
+
+    int slot = d->next_mark;
+    for (int i = 0; i < VLFS_DIR_MARKS; ++i) {
+        if (d->marks[i].loc == m.loc) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == d->next_mark) {
+        d->next_mark = (d->next_mark + 1) % VLFS_DIR_MARKS;
+    }
+    d->marks[slot] = m;
+    return m.loc;
+}
+
+void vlfs_seekdir(void *ctx, DIR *newlib_d, long loc)
+{
+    vlfs_dir_t *d = (vlfs_dir_t*) newlib_d;
+    int err;
+    d->batch_len = d->batch_pos = 0;
+    for (int i = 0; i < VLFS_DIR_MARKS; ++i) {
+        const vlfs_dir_mark_t *m = &d->marks[i];
+        if (loc >= 0 && m->loc == loc) {
+            err = lfs_dir_seekcursor(ctx, &d->lfs_d, &m->cursor);
+            if (err >= 0 && m->skip) {
+                err = vlfs_dir_fill(ctx, d);
+                if (err >= 0) {
+                    d->batch_pos = m->skip < d->batch_len
+                        ? m->skip : d->batch_len;
+                }
+            }
+            goto done;
+        }
+    }
+    /* not from telldir on this stream, or forgotten: walk to it */
+    err = lfs_dir_seek(ctx, &d->lfs_d, loc < 0 ? 0 : (lfs_off_t) loc);
+done:
+    if (err < 0) {
+        errno = vlfs_tr_error(err);
+    }
+}
+
 int vlfs_mkdir(void *ctx, const char *path, mode_t mode)
 {
     (void) mode;
@@ -238,6 +434,9 @@ int vlfs_truncate(void *ctx, const char *path, off_t length)
         return fd;
     }
     int err = lfs_file_truncate(ctx, vlfs_file_p(ctx, fd), length);
+    if (!err) {
+        esp_lfs_fd_touch(fd);
+    }
     vlfs_close(ctx, fd);
     return vlfs_set_errno(err);
 }
@@ -252,6 +451,7 @@ static const esp_vfs_t the_littlefs_vfs_funcs = {
     .open_p = vlfs_open,
     .close_p = vlfs_close,
     .fsync_p = vlfs_fsync,
+    .fstat_p = vlfs_fstat,
     .read_p = vlfs_read,
     .lseek_p = vlfs_lseek,
 
@@ -269,13 +469,13 @@ static const esp_vfs_t the_littlefs_vfs_funcs = {
     .opendir_p = vlfs_opendir,
     .closedir_p = vlfs_closedir,
     .readdir_p = vlfs_readdir,
+    .readdir_r_p = vlfs_readdir_r,
+    .telldir_p = vlfs_telldir,
+    .seekdir_p = vlfs_seekdir,
 #ifndef LFS_READONLY
     .mkdir_p = vlfs_mkdir,
     .rmdir_p = vlfs_unlink,
 #endif
-//    .readdir_r_p = vlfs_readdir_r,
-//    .telldir_p = vlfs_telldir,
-//    .seekdir_p = vlfs_seekdir,
 //    .access_p = vlfs_access,
 //    .utime_p = vlfs_utime,
 #endif
@@ -323,6 +523,20 @@ int esp_vfs_littlefs_mount(const char* base_path, const struct lfs_config *cfg,
     return 0;
 }
 
+int esp_vfs_littlefs_syncfs(const char* base_path)
+{
+    if (!has_mounted) {
+        ESP_LOGE(TAG, "syncfs %s: not mounted", base_path);
+        errno = ENODEV;
+        return -1;
+    }
+#ifndef LFS_READONLY
+    return vlfs_set_errno(lfs_fs_sync(&my_ctx.lfs));
+#else
+    return 0;
+#endif
+}
+
 int esp_vfs_littlefs_unmount(const char* base_path)
 {
     ESP_LOGI(TAG, "unmount %s", base_path);
@@ -331,6 +545,7 @@ int esp_vfs_littlefs_unmount(const char* base_path)
         ESP_LOGE(TAG, "unmount failed, error=%d", err);
         return -1;
     }
+    esp_vfs_unregister(base_path);
     has_mounted = 0;
     return 0;
 }
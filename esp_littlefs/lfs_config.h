@@ -1,7 +1,10 @@
-#ifndef LFS_UTIL_H
-#define LFS_UTIL_H
+#ifndef LFS_CONFIG_H
+#define LFS_CONFIG_H
 
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
+#include <inttypes.h>
 #include "esp_types.h"
 #include "esp_log.h"
 #include "endian.h" /* newlib/platform_include */
@@ -0,0 +1,605 @@
+/*
+ * Benchmarks and regression checks for the esp_littlefs glue, run on the
+ * host against the mocks in this directory.
+ *
+ * usage: bench [image]
+ * With an image path the simulated card is kept in that file, otherwise
+ * it lives in RAM.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "littlefs/lfs.h"
+#include "vfs/vfs_littlefs.h"
+#include "sdkconfig.h"
+#include "sdmmc_cmd.h"
+#include "esp_heap_caps.h"
+#include "mock.h"
+
+#define MAX_FILES 64
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static uint8_t pattern(size_t i, int seed)
+{
+    return (uint8_t) (i * 31 + seed * 7 + (i >> 9));
+}
+
+/* lfs_setup_sdmmc: geometry picked for various cards, and its DMA caches */
+static void test_geometry(void)
+{
+    static const struct mock_sdmmc_config cards[] = {
+        {.capacity = 16384, .sector_size = 512, .read_block_len = 9},
+        {.capacity = 2097152, .sector_size = 512, .read_block_len = 9},
+        {.capacity = 2097152, .sector_size = 512, .read_block_len = 10},
+        {.capacity = 2097152, .sector_size = 512, .read_block_len = 11},
+        {.capacity = 62333952, .sector_size = 512, .read_block_len = 9},
+    };
+
+    printf("geometry:\n");
+    for (size_t i = 0; i < sizeof(cards) / sizeof(cards[0]); ++i) {
+        CHECK(mock_sdmmc_setup(&cards[i]) == 0);
+        sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+        sdmmc_card_t card;
+        CHECK(sdmmc_card_init(&host, &card) == ESP_OK);
+
+        struct lfs_config *c = lfs_setup_sdmmc(&card);
+        CHECK(c != NULL);
+        if (!c) {
+            continue;
+        }
+        uint64_t capacity = (uint64_t) card.csd.capacity * card.csd.sector_size;
+        printf("  %6lluMB read_block_len=%d: read %u prog %u block %u "
+                "count %u cache %u\n",
+                (unsigned long long) (capacity >> 20), card.csd.read_block_len,
+                (unsigned) c->read_size, (unsigned) c->prog_size,
+                (unsigned) c->block_size, (unsigned) c->block_count,
+                (unsigned) c->cache_size);
+
+        /* the glue converts sizes to whole sectors */
+        CHECK(c->read_size % card.csd.sector_size == 0);
+        CHECK(c->prog_size % card.csd.sector_size == 0);
+        CHECK(c->block_size % c->read_size == 0);
+        CHECK(c->block_size % c->prog_size == 0);
+        CHECK(c->block_size % c->cache_size == 0);
+        CHECK(c->lookahead_size % 8 == 0);
+        CHECK((uint64_t) c->block_count * c->block_size <= capacity);
+
+        /* caches come from DMA-capable memory, and are given back */
+        CHECK(mock_stats()->dma_allocs == 2);
+        CHECK(mock_heap_dma_capable(c->read_buffer));
+        CHECK(mock_heap_dma_capable(c->prog_buffer));
+        lfs_setup_sdmmc_cleanup(c);
+        CHECK(mock_stats()->dma_frees == mock_stats()->dma_allocs);
+    }
+    mock_sdmmc_teardown();
+}
+
+/* lfs_setup_sdmmc_tuned: cards that want different block sizes */
+static void test_autotune(void)
+{
+    static const struct {
+        struct mock_sdmmc_config card;
+        uint32_t block_size;
+    } cards[] = {
+        {{.capacity = 2097152, .sector_size = 512, .read_block_len = 9,
+            .cmd_us = 100, .read_us = 20, .page_size = 16384, .page_us = 1500,
+            .au_size = 4 << 20}, 16384},
+        {{.capacity = 2097152, .sector_size = 512, .read_block_len = 9,
+            .cmd_us = 100, .read_us = 20, .page_size = 4096, .page_us = 400,
+            .au_size = 4 << 20}, 8192},
+        {{.capacity = 2097152, .sector_size = 512, .read_block_len = 9,
+            .cmd_us = 100, .read_us = 20, .page_size = 65536, .page_us = 4000,
+            .au_size = 32768}, 32768},
+    };
+
+    printf("autotune:\n");
+    for (size_t i = 0; i < sizeof(cards) / sizeof(cards[0]); ++i) {
+        CHECK(mock_sdmmc_setup(&cards[i].card) == 0);
+        sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+        sdmmc_card_t card;
+        CHECK(sdmmc_card_init(&host, &card) == ESP_OK);
+
+        struct lfs_config *c = lfs_setup_sdmmc_tuned(&card, true);
+        CHECK(c != NULL);
+        if (!c) {
+            continue;
+        }
+        const struct lfs_sdmmc_tuning *t = lfs_sdmmc_tuning(c);
+        printf("  page %6u au %7u: block %u (%u kB/s) cache %u (%u kB/s) "
+                "lookahead %u\n",
+                (unsigned) cards[i].card.page_size,
+                (unsigned) t->au_size, (unsigned) t->block_size,
+                (unsigned) t->write_kbps, (unsigned) t->cache_size,
+                (unsigned) t->read_kbps, (unsigned) t->lookahead_size);
+        CHECK(t->au_size == cards[i].card.au_size);
+        CHECK(c->block_size == cards[i].block_size);
+        CHECK(c->block_size % c->cache_size == 0);
+        CHECK(c->lookahead_size % 8 == 0);
+
+        /* the default block size only mounts if it is the stored one */
+        lfs_t lfs;
+        CHECK(lfs_format(&lfs, c) == 0);
+        lfs_setup_sdmmc_cleanup(c);
+        c = lfs_setup_sdmmc_tuned(&card, false);
+        CHECK(c != NULL);
+        if (c) {
+            CHECK(lfs_mount(&lfs, c) == (c->block_size
+                    == cards[i].block_size ? 0 : LFS_ERR_INVAL));
+            lfs_setup_sdmmc_cleanup(c);
+        }
+
+        /* the block size is found again on the formatted card, from either
+         * block of the superblock pair */
+        for (int wipe = 0; wipe < 2; ++wipe) {
+            if (wipe) {
+                uint8_t zero[512] = {0};
+                CHECK(sdmmc_write_sectors(&card, zero, 0, 1) == ESP_OK);
+            }
+            c = lfs_setup_sdmmc_stored(&card);
+            CHECK(c && c->block_size == cards[i].block_size);
+            CHECK(c && lfs_mount(&lfs, c) == 0);
+            CHECK(c && lfs_unmount(&lfs) == 0);
+            if (c) {
+                lfs_setup_sdmmc_cleanup(c);
+            }
+        }
+    }
+    mock_sdmmc_teardown();
+}
+
+static void write_file(const char *path, size_t size, size_t chunk,
+        const uint8_t *src, int seed)
+{
+    int fd = mock_vfs_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+    uint8_t *buf = (uint8_t *) src;
+    for (size_t off = 0; off < size; off += chunk) {
+        size_t n = (size - off < chunk) ? size - off : chunk;
+        for (size_t i = 0; i < n; ++i) {
+            buf[i] = pattern(off + i, seed);
+        }
+        CHECK(mock_vfs_write(fd, buf, n) == (ssize_t) n);
+    }
+    CHECK(mock_vfs_close(fd) == 0);
+}
+
+static void read_file(const char *path, size_t size, size_t chunk,
+        uint8_t *dst, int seed)
+{
+    int fd = mock_vfs_open(path, O_RDONLY, 0);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+    bool ok = true;
+    for (size_t off = 0; off < size; off += chunk) {
+        size_t n = (size - off < chunk) ? size - off : chunk;
+        CHECK(mock_vfs_read(fd, dst, n) == (ssize_t) n);
+        for (size_t i = 0; i < n; ++i) {
+            ok = ok && dst[i] == pattern(off + i, seed);
+        }
+    }
+    CHECK(ok);
+    CHECK(mock_vfs_read(fd, dst, 1) == 0);
+    CHECK(mock_vfs_close(fd) == 0);
+}
+
+/* sequential files through the VFS, with aligned and unaligned buffers */
+static void test_files(void)
+{
+    static const size_t chunks[] = {64, 512, 4096, 32768};
+    const size_t size = 1024 * 1024;
+    uint8_t *buf = malloc(32768 + 4);
+    char path[32];
+    char title[64];
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+        for (int unaligned = 0; unaligned <= 1; ++unaligned) {
+            snprintf(path, sizeof(path), "/sd/seq%zu_%d", chunks[i], unaligned);
+
+            mock_stats_reset();
+            write_file(path, size, chunks[i], buf + unaligned, (int) i);
+            snprintf(title, sizeof(title), "write 1MB in %zuB chunks%s:",
+                    chunks[i], unaligned ? " (unaligned)" : "");
+            mock_stats_print(title);
+
+            mock_stats_reset();
+            read_file(path, size, chunks[i], buf + unaligned, (int) i);
+            snprintf(title, sizeof(title), "read 1MB in %zuB chunks%s:",
+                    chunks[i], unaligned ? " (unaligned)" : "");
+            mock_stats_print(title);
+            CHECK(unaligned || mock_stats()->unaligned == 0);
+        }
+    }
+
+    /* DMA-capable buffers are written from and read into directly where
+     * file data is aligned in its blocks. CTZ blocks start with their
+     * skip-list pointers, extents don't */
+    uint8_t *dma = heap_caps_malloc(4096, MALLOC_CAP_DMA);
+    mock_stats_reset();
+    write_file("/sd/dma", size, 4096, dma, 2);
+    mock_stats_print("write 1MB in 4096B chunks (DMA-capable):");
+#if CONFIG_LFS_FILE_EXTENTS > 0
+    CHECK(mock_stats()->write_sectors < size / 512 + size / 512 / 16);
+    CHECK(mock_stats()->bounced == 0);
+#endif
+
+    mock_stats_reset();
+    read_file("/sd/dma", size, 4096, dma, 2);
+    mock_stats_print("read 1MB in 4096B chunks (DMA-capable):");
+#if CONFIG_LFS_FILE_EXTENTS > 0
+    CHECK(mock_stats()->read_sectors < size / 512 + size / 512 / 16);
+    CHECK(mock_stats()->bounced == 0);
+#endif
+    heap_caps_free(dma);
+
+    mock_stats_reset();
+    for (int i = 0; i < 64; ++i) {
+        snprintf(path, sizeof(path), "/sd/small%d", i);
+        write_file(path, 100, 100, buf, i);
+    }
+    mock_stats_print("create 64 small files:");
+    free(buf);
+}
+
+/* descriptors are limited, and are given back by close and failed opens */
+static void test_fds(void)
+{
+    int fds[MAX_FILES + 1];
+    char path[32];
+
+    for (int round = 0; round < 2; ++round) {
+        int n = 0;
+        for (; n < MAX_FILES + 1; ++n) {
+            snprintf(path, sizeof(path), "/sd/fd%d", n);
+            fds[n] = mock_vfs_open(path, O_WRONLY | O_CREAT, 0644);
+            if (fds[n] < 0) {
+                break;
+            }
+        }
+        CHECK(n == MAX_FILES);
+        CHECK(errno == ENFILE);
+        for (int i = 0; i < n; ++i) {
+            CHECK(mock_vfs_close(fds[i]) == 0);
+        }
+
+        for (int i = 0; i < MAX_FILES + 1; ++i) {
+            CHECK(mock_vfs_open("/sd/nonexistent", O_RDONLY, 0) < 0);
+            CHECK(errno == ENOENT);
+        }
+    }
+    printf("fds: %d open files at once\n", MAX_FILES);
+}
+
+/* many readers open at once, their buffers come from the pool if any */
+static void test_readers(void)
+{
+    enum { N = 16 };
+    int fds[N];
+    char path[32];
+    uint8_t buf[100];
+    struct stat st;
+
+    CHECK(mock_vfs_stat("/sd/small0", &st) == 0);
+    size_t before = mallinfo2().uordblks;
+    for (int i = 0; i < N; ++i) {
+        snprintf(path, sizeof(path), "/sd/small%d", i);
+        fds[i] = mock_vfs_open(path, O_RDONLY, 0);
+        CHECK(fds[i] >= 0);
+    }
+    size_t heap = mallinfo2().uordblks - before;
+    if (CONFIG_LFS_FILE_POOL >= N) {
+        CHECK(heap == 0);
+    } else if (CONFIG_LFS_FILE_POOL > 0) {
+        /* the rest fall back to the heap, still with sector sized buffers */
+        CHECK(heap > 0 && heap < N * (size_t) st.st_blksize);
+    } else {
+        CHECK(heap >= N * (size_t) st.st_blksize);
+    }
+
+    for (int i = 0; i < N; ++i) {
+        CHECK(mock_vfs_read(fds[i], buf, sizeof(buf)) == sizeof(buf));
+        bool ok = true;
+        for (size_t j = 0; j < sizeof(buf); ++j) {
+            ok = ok && buf[j] == pattern(j, i);
+        }
+        CHECK(ok);
+        CHECK(mock_vfs_close(fds[i]) == 0);
+    }
+    printf("readers: %zu bytes of heap for %d open files\n", heap, N);
+}
+
+/* stat and fstat sizes, block usage, inode numbers and times */
+static void test_stat(void)
+{
+    const size_t size = 256 * 1024;
+    uint8_t *buf = malloc(4096);
+    struct stat st, fst;
+    time_t start = time(NULL);
+
+    int fd = mock_vfs_open("/sd/stat", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0);
+    for (size_t i = 0; i < size; i += 4096) {
+        CHECK(mock_vfs_write(fd, buf, 4096) == 4096);
+    }
+    mock_stats_reset();
+    CHECK(mock_vfs_fstat(fd, &fst) == 0);
+    CHECK(mock_stats()->reads <= 1);
+    CHECK(S_ISREG(fst.st_mode));
+    CHECK(fst.st_size == (off_t) size);
+    CHECK(fst.st_blksize >= 512 && fst.st_blksize % 512 == 0);
+    CHECK(fst.st_blocks >= (blkcnt_t) (size / 512));
+    CHECK(fst.st_mtime >= start);
+    CHECK(mock_vfs_close(fd) == 0);
+
+    CHECK(mock_vfs_stat("/sd/stat", &st) == 0);
+    CHECK(st.st_size == fst.st_size);
+    CHECK(st.st_blocks == fst.st_blocks);
+    CHECK(st.st_blksize == fst.st_blksize);
+    CHECK(st.st_ino == fst.st_ino);
+    CHECK(st.st_mtime == fst.st_mtime);
+
+    /* opening for writing and closing without a write commits nothing */
+    mock_stats_reset();
+    fd = mock_vfs_open("/sd/stat", O_WRONLY, 0);
+    CHECK(fd >= 0);
+    CHECK(mock_vfs_fstat(fd, &fst) == 0);
+    CHECK(fst.st_mtime == st.st_mtime);
+    CHECK(mock_vfs_close(fd) == 0);
+    CHECK(mock_stats()->writes == 0);
+
+    /* readers report the cache they actually got, maybe from the pool */
+    fd = mock_vfs_open("/sd/stat", O_RDONLY, 0);
+    CHECK(fd >= 0);
+    CHECK(mock_vfs_fstat(fd, &fst) == 0);
+    CHECK(fst.st_blksize >= 512 && fst.st_blksize <= st.st_blksize);
+    CHECK(fst.st_ino == st.st_ino);
+    CHECK(mock_vfs_close(fd) == 0);
+
+    CHECK(mock_vfs_stat("/sd/small0", &st) == 0);
+    CHECK(st.st_ino != fst.st_ino);
+    CHECK(st.st_blocks == 0); /* inline */
+
+    printf("stat: st_blksize %ld, st_blocks %ld for %zu bytes\n",
+            (long) fst.st_blksize, (long) fst.st_blocks, size);
+    free(buf);
+}
+
+/* small seeks that stay inside the file's cache don't go back to the card */
+static void test_seek(void)
+{
+    const size_t size = 4096;
+    uint8_t *buf = malloc(size);
+    uint8_t rec[16];
+    write_file("/sd/seek", size, size, buf, 3);
+
+    int fd = mock_vfs_open("/sd/seek", O_RDWR, 0);
+    CHECK(fd >= 0);
+    CHECK(mock_vfs_read(fd, rec, sizeof(rec)) == sizeof(rec));
+    mock_stats_reset();
+    for (int i = 0; i < 16; ++i) {
+        CHECK(mock_vfs_lseek(fd, -8, SEEK_CUR) == 8 + 8 * i);
+        CHECK(mock_vfs_read(fd, rec, sizeof(rec)) == sizeof(rec));
+        CHECK(rec[0] == pattern(8 + 8 * i, 3));
+    }
+    CHECK(mock_stats()->reads == 0);
+
+    /* overwrite the same records, nothing is programmed until close */
+    memset(rec, 0xa5, sizeof(rec));
+    CHECK(mock_vfs_lseek(fd, 0, SEEK_SET) == 0);
+    CHECK(mock_vfs_write(fd, rec, sizeof(rec)) == sizeof(rec));
+    mock_stats_reset();
+    for (int i = 0; i < 16; ++i) {
+        CHECK(mock_vfs_lseek(fd, -8, SEEK_CUR) == 8 + 8 * i);
+        CHECK(mock_vfs_write(fd, rec, sizeof(rec)) == sizeof(rec));
+    }
+    CHECK(mock_stats()->reads == 0 && mock_stats()->writes == 0);
+    CHECK(mock_vfs_lseek(fd, 0, SEEK_END) == (off_t) size);
+    CHECK(mock_vfs_close(fd) == 0);
+    mock_stats_print("seek inside the cache:");
+
+    fd = mock_vfs_open("/sd/seek", O_RDONLY, 0);
+    CHECK(fd >= 0);
+    CHECK(mock_vfs_read(fd, buf, size) == (ssize_t) size);
+    bool ok = true;
+    for (size_t i = 0; i < size; ++i) {
+        ok = ok && buf[i] == (i < 8 * 16 + 16 ? 0xa5 : pattern(i, 3));
+    }
+    CHECK(ok);
+    CHECK(mock_vfs_close(fd) == 0);
+    free(buf);
+}
+
+/* a log that is synced every few hundred bytes */
+static void test_log(void)
+{
+    const size_t rec = 200, count = 64;
+    uint8_t *buf = malloc(rec * count);
+
+    int fd = mock_vfs_open("/sd/log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+    CHECK(fd >= 0);
+    mock_stats_reset();
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < rec; ++j) {
+            buf[j] = pattern(i * rec + j, 4);
+        }
+        CHECK(mock_vfs_write(fd, buf, rec) == (ssize_t) rec);
+        CHECK(mock_vfs_fsync(fd) == 0);
+    }
+    CHECK(mock_vfs_close(fd) == 0);
+#if CONFIG_LFS_APPEND_LOG
+    /* each sync rewrites the sector the log ends in, and commits */
+    CHECK(mock_stats()->write_sectors < count * 4);
+#endif
+    mock_stats_print("log synced every 200 bytes:");
+
+    read_file("/sd/log", rec * count, rec * count, buf, 4);
+    free(buf);
+}
+
+/* files too big to inline but no bigger than the cache */
+static void test_pack(void)
+{
+    enum { N = 32 };
+    struct stat st;
+    char path[32];
+
+    CHECK(mock_vfs_stat("/sd/small0", &st) == 0);
+    size_t size = st.st_blksize;
+    uint8_t *buf = malloc(size);
+
+    mock_stats_reset();
+    for (int i = 0; i < N; ++i) {
+        snprintf(path, sizeof(path), "/sd/pack%02d", i);
+        write_file(path, size, size, buf, i);
+    }
+    mock_stats_print("small files one cache in size:");
+
+    for (int i = 0; i < N; ++i) {
+        snprintf(path, sizeof(path), "/sd/pack%02d", i);
+        CHECK(mock_vfs_stat(path, &st) == 0);
+        CHECK(st.st_size == (off_t) size);
+#if CONFIG_LFS_PACK_FILES
+        /* fragments share their blocks with other files */
+        CHECK(st.st_blocks == 0);
+#else
+        CHECK(st.st_blocks > 0);
+#endif
+        read_file(path, size, size, buf, i);
+    }
+    free(buf);
+}
+
+/* listing a large directory, entries come from lfs_dir_readbatch */
+static void test_listdir(void)
+{
+    enum { N = 500, PAGE = 37 };
+    static bool seen[N];
+    uint8_t buf[16];
+    char path[32];
+    char title[64];
+
+    CHECK(mock_vfs_mkdir("/sd/list", 0755) == 0);
+    for (int i = 0; i < N; ++i) {
+        snprintf(path, sizeof(path), "/sd/list/e%03d", i);
+        write_file(path, sizeof(buf), sizeof(buf), buf, i);
+    }
+
+    mock_stats_reset();
+    DIR *dir = mock_vfs_opendir("/sd/list");
+    CHECK(dir != NULL);
+    int n = 0;
+    struct dirent *de;
+    while (dir && (de = mock_vfs_readdir(dir))) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        int i = atoi(&de->d_name[1]);
+        CHECK(de->d_type == DT_REG);
+        CHECK(i >= 0 && i < N && !seen[i]);
+        if (i >= 0 && i < N) {
+            seen[i] = true;
+        }
+        n++;
+    }
+    CHECK(n == N);
+    CHECK(dir && mock_vfs_closedir(dir) == 0);
+    snprintf(title, sizeof(title), "list %d entries:", N);
+    mock_stats_print(title);
+
+    /* pages served from telldir locations, each page seeks back to where
+     * the previous one stopped after the stream was used elsewhere */
+    mock_stats_reset();
+    dir = mock_vfs_opendir("/sd/list");
+    CHECK(dir != NULL);
+    long loc = 0;
+    int pages = 0;
+    n = 0;
+    for (bool end = false; dir && !end; ++pages) {
+        mock_vfs_seekdir(dir, 0);
+        CHECK(mock_vfs_readdir(dir) != NULL);
+        mock_vfs_seekdir(dir, loc);
+        CHECK(mock_vfs_telldir(dir) == loc);
+        for (int j = 0; j < PAGE; ++j) {
+            struct dirent entry, *out;
+            CHECK(mock_vfs_readdir_r(dir, &entry, &out) == 0);
+            if (!out) {
+                end = true;
+                break;
+            }
+            if (out->d_name[0] == '.') {
+                continue;
+            }
+            int i = atoi(&out->d_name[1]);
+            CHECK(i >= 0 && i < N && seen[i]);
+            if (i >= 0 && i < N) {
+                seen[i] = false;
+            }
+            n++;
+        }
+        loc = mock_vfs_telldir(dir);
+        CHECK(loc >= 0);
+    }
+    CHECK(n == N);
+    CHECK(dir && mock_vfs_closedir(dir) == 0);
+    snprintf(title, sizeof(title), "list %d entries in %d pages:", N, pages);
+    mock_stats_print(title);
+}
+
+int main(int argc, char **argv)
+{
+    test_geometry();
+    test_autotune();
+
+    const struct mock_sdmmc_config card = {
+        .capacity = 131072,
+        .sector_size = 512,
+        .read_block_len = 9,
+        .path = (argc > 1) ? argv[1] : NULL,
+        .spiram_malloc = true,
+    };
+    CHECK(mock_sdmmc_setup(&card) == 0);
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    sdmmc_slot_config_t slot = SDMMC_SLOT_CONFIG_DEFAULT();
+    CHECK(vfs_littlefs_sdmmc_mount("/sd", &host, &slot, LFS_FLAG_FORMAT)
+            == ESP_OK);
+
+    test_files();
+    test_fds();
+    test_readers();
+    test_stat();
+    test_seek();
+    test_log();
+    test_pack();
+    test_listdir();
+
+    /* everything is still there after a remount */
+    CHECK(vfs_littlefs_unmount("/sd") == 0);
+    CHECK(vfs_littlefs_sdmmc_mount("/sd", &host, &slot, 0) == ESP_OK);
+    uint8_t *buf = malloc(4096);
+    read_file("/sd/seq4096_0", 1024 * 1024, 4096, buf, 2);
+    struct stat st;
+    CHECK(mock_vfs_stat("/sd/pack07", &st) == 0);
+    read_file("/sd/pack07", st.st_size, 4096, buf, 7);
+    free(buf);
+    CHECK(vfs_littlefs_unmount("/sd") == 0);
+    mock_sdmmc_teardown();
+
+    printf("%s, %d failures\n", failures ? "FAILED" : "passed", failures);
+    return failures ? 1 : 0;
+}
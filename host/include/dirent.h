@@ -0,0 +1,24 @@
+/*
+ * Host stand-in for esp-idf's newlib dirent.h, the VFS defines DIR
+ */
+#ifndef DIRENT_H
+#define DIRENT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct {
+    uint16_t dd_vfs_idx;
+    uint16_t dd_rsv;
+} DIR;
+
+struct dirent {
+    ino_t d_ino;
+    uint8_t d_type;
+#define DT_UNKNOWN  0
+#define DT_REG      1
+#define DT_DIR      2
+    char d_name[256];
+};
+
+#endif
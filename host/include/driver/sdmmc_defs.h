@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for esp-idf's driver/sdmmc_defs.h
+ */
+#ifndef SDMMC_DEFS_H
+#define SDMMC_DEFS_H
+
+#define SDMMC_SECTOR_SIZE 512
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Host stand-in for esp-idf's driver/sdmmc_host.h
+ */
+#ifndef SDMMC_HOST_H
+#define SDMMC_HOST_H
+
+#include "driver/sdmmc_types.h"
+
+#define SDMMC_HOST_SLOT_0 0
+#define SDMMC_HOST_SLOT_1 1
+
+typedef struct {
+    int gpio_cd;
+    int gpio_wp;
+    uint8_t width;
+    uint32_t flags;
+} sdmmc_slot_config_t;
+
+esp_err_t sdmmc_host_init(void);
+esp_err_t sdmmc_host_deinit(void);
+esp_err_t sdmmc_host_init_slot(int slot, const sdmmc_slot_config_t *slot_config);
+
+#define SDMMC_HOST_DEFAULT() { \
+    .flags = SDMMC_HOST_FLAG_4BIT | SDMMC_HOST_FLAG_1BIT, \
+    .slot = SDMMC_HOST_SLOT_1, \
+    .max_freq_khz = SDMMC_FREQ_DEFAULT, \
+    .io_voltage = 3.3f, \
+    .init = &sdmmc_host_init, \
+    .deinit = &sdmmc_host_deinit, \
+}
+
+#define SDMMC_SLOT_CONFIG_DEFAULT() { \
+    .gpio_cd = -1, \
+    .gpio_wp = -1, \
+    .width = 4, \
+    .flags = 0, \
+}
+
+#endif
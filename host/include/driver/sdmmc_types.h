@@ -0,0 +1,87 @@
+/*
+ * Host stand-in for esp-idf's driver/sdmmc_types.h, only the fields used
+ * by esp_littlefs are provided
+ */
+#ifndef SDMMC_TYPES_H
+#define SDMMC_TYPES_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "soc/soc_caps.h"
+
+typedef struct {
+    int csd_ver;
+    int mmc_ver;
+    int capacity;
+    int sector_size;
+    int read_block_len;
+    int card_command_class;
+    int tr_speed;
+} sdmmc_csd_t;
+
+typedef struct {
+    int mfg_id;
+    int oem_id;
+    char name[8];
+    int revision;
+    int serial;
+    int date;
+} sdmmc_cid_t;
+
+typedef struct {
+    int sd_spec;
+    int bus_width;
+} sdmmc_scr_t;
+
+typedef struct {
+    uint32_t alloc_unit_kb: 16;
+    uint32_t erase_size_au: 16;
+    uint32_t cur_bus_width: 2;
+    uint32_t discard_support: 1;
+    uint32_t fule_support: 1;
+    uint32_t erase_timeout: 6;
+    uint32_t erase_offset: 2;
+    uint32_t reserved: 20;
+} sdmmc_ssr_t;
+
+#define SDMMC_HOST_FLAG_1BIT        (1<<0)
+#define SDMMC_HOST_FLAG_4BIT        (1<<1)
+#define SDMMC_HOST_FLAG_8BIT        (1<<2)
+#define SDMMC_HOST_FLAG_SPI         (1<<3)
+#define SDMMC_HOST_FLAG_DDR         (1<<4)
+#define SDMMC_HOST_FLAG_DEINIT_ARG  (1<<5)
+
+#define SDMMC_FREQ_DEFAULT      20000
+#define SDMMC_FREQ_HIGHSPEED    40000
+
+typedef struct {
+    uint32_t flags;
+    int slot;
+    int max_freq_khz;
+    float io_voltage;
+    esp_err_t (*init)(void);
+    union {
+        esp_err_t (*deinit)(void);
+        esp_err_t (*deinit_p)(int slot);
+    };
+} sdmmc_host_t;
+
+typedef struct {
+    sdmmc_host_t host;
+    uint32_t ocr;
+    sdmmc_cid_t cid;
+    sdmmc_csd_t csd;
+    sdmmc_scr_t scr;
+    sdmmc_ssr_t ssr;
+    uint16_t rca;
+    uint16_t max_freq_khz;
+    uint32_t is_mem : 1;
+    uint32_t is_sdio : 1;
+    uint32_t is_mmc : 1;
+    uint32_t num_io_functions : 3;
+    uint32_t log_bus_width : 2;
+    uint32_t is_ddr : 1;
+    uint32_t reserved : 23;
+} sdmmc_card_t;
+
+#endif
@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for the esp32 ROM's crc routines
+ */
+#ifndef ROM_CRC_H
+#define ROM_CRC_H
+
+#include <stdint.h>
+
+// CRC-32 as in the ROM, initial and final values are inverted
+uint32_t crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len);
+
+#endif
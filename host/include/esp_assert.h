@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for esp-idf's esp_assert.h
+ */
+#ifndef ESP_ASSERT_H
+#define ESP_ASSERT_H
+
+#include <assert.h>
+
+// same as esp-idf, only checks conditions known at compile time
+#define TRY_STATIC_ASSERT(CONDITION, MSG) do { \
+        _Static_assert(__builtin_choose_expr(__builtin_constant_p(CONDITION), \
+                (CONDITION), 1), #MSG); \
+    } while (0)
+
+#endif
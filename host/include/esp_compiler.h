@@ -0,0 +1,10 @@
+/*
+ * Host stand-in for esp-idf's esp_compiler.h
+ */
+#ifndef ESP_COMPILER_H
+#define ESP_COMPILER_H
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#endif
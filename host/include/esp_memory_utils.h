@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for esp-idf's esp_memory_utils.h
+ */
+#ifndef ESP_MEMORY_UTILS_H
+#define ESP_MEMORY_UTILS_H
+
+#include <stdbool.h>
+
+// see mock_sdmmc_config.spiram_malloc
+bool esp_ptr_dma_capable(const void *p);
+
+#endif
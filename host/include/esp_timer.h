@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for esp-idf's esp_timer.h. Time is simulated by the mock
+ * card, see mock_sdmmc_config
+ */
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif
@@ -0,0 +1,11 @@
+/*
+ * Host stand-in for esp-idf's esp_types.h
+ */
+#ifndef ESP_TYPES_H
+#define ESP_TYPES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#endif
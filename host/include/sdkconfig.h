@@ -0,0 +1,58 @@
+/*
+ * Host stand-in for a generated sdkconfig.h, with the defaults from Kconfig
+ */
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+#define CONFIG_VFS_SUPPORT_DIR 1
+
+#ifndef CONFIG_LFS_THREADSAFE_DEF
+#define CONFIG_LFS_THREADSAFE_DEF 1
+#endif
+
+#ifndef CONFIG_LFS_FILE_EXTENTS
+#define CONFIG_LFS_FILE_EXTENTS 0
+#endif
+
+#ifndef CONFIG_LFS_APPEND_LOG
+#define CONFIG_LFS_APPEND_LOG 0
+#endif
+
+#ifndef CONFIG_LFS_PACK_FILES
+#define CONFIG_LFS_PACK_FILES 0
+#endif
+
+#ifndef CONFIG_LFS_FILE_POOL
+#define CONFIG_LFS_FILE_POOL 0
+#endif
+
+#ifndef CONFIG_LFS_DIR_BATCH
+#define CONFIG_LFS_DIR_BATCH 8
+#endif
+
+#ifndef CONFIG_LFS_DIR_MARKS
+#define CONFIG_LFS_DIR_MARKS 8
+#endif
+
+#ifndef CONFIG_LFS_MTIME
+#define CONFIG_LFS_MTIME 1
+#endif
+
+#ifndef CONFIG_LFS_COMPACT_SIZE
+#define CONFIG_LFS_COMPACT_SIZE 2048
+#endif
+
+#ifndef CONFIG_LFS_INDEX_SIZE
+#define CONFIG_LFS_INDEX_SIZE 1024
+#endif
+
+#ifndef CONFIG_LFS_PARENT_SIZE
+#define CONFIG_LFS_PARENT_SIZE 0
+#endif
+
+#if !defined(CONFIG_LFS_VERIFY_ALWAYS) && !defined(CONFIG_LFS_VERIFY_SAMPLED) \
+        && !defined(CONFIG_LFS_VERIFY_NEVER)
+#define CONFIG_LFS_VERIFY_METADATA 1
+#endif
+
+#endif
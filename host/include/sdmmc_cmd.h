@@ -0,0 +1,20 @@
+/*
+ * Host stand-in for esp-idf's sdmmc_cmd.h, see host/mock.h to set up the
+ * simulated card
+ */
+#ifndef SDMMC_CMD_H
+#define SDMMC_CMD_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "driver/sdmmc_types.h"
+
+esp_err_t sdmmc_card_init(const sdmmc_host_t *host, sdmmc_card_t *out_card);
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card);
+esp_err_t sdmmc_read_sectors(sdmmc_card_t *card, void *dst,
+        size_t start_sector, size_t sector_count);
+esp_err_t sdmmc_write_sectors(sdmmc_card_t *card, const void *src,
+        size_t start_sector, size_t sector_count);
+
+#endif
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for esp-idf's soc_caps.h
+ */
+#ifndef SOC_CAPS_H
+#define SOC_CAPS_H
+
+#define SOC_SDMMC_HOST_SUPPORTED 1
+
+#endif
@@ -0,0 +1,21 @@
+/*
+ * Host stand-in for newlib's sys/lock.h, backed by pthread mutexes
+ */
+#ifndef SYS_LOCK_H
+#define SYS_LOCK_H
+
+// like esp-idf, a zeroed lock is initialized on first use
+typedef struct mock_lock *_lock_t;
+
+void _lock_init(_lock_t *lock);
+void _lock_init_recursive(_lock_t *lock);
+void _lock_close(_lock_t *lock);
+void _lock_close_recursive(_lock_t *lock);
+void _lock_acquire(_lock_t *lock);
+void _lock_acquire_recursive(_lock_t *lock);
+int _lock_try_acquire(_lock_t *lock);
+int _lock_try_acquire_recursive(_lock_t *lock);
+void _lock_release(_lock_t *lock);
+void _lock_release_recursive(_lock_t *lock);
+
+#endif
@@ -0,0 +1,527 @@
+/*
+ * Checks a littlefs image on the host, for example one pulled off a card.
+ *
+ * usage: lfsck [-j jobs] [-b block_size] image
+ * The block size is read from the superblock if not given. Exits with 0
+ * if the image is clean, 1 if problems were found and 2 if it could not
+ * be checked.
+ *
+ * The image is mapped read-only and each job mounts it on its own. Jobs
+ * take the metadata pairs in turn with lfs_fs_traverseinfo, which finds
+ * each pair's tail before its files, so the next pair is handed on to an
+ * idle job while this one walks the files, and every pair is only
+ * fetched once. The
+ * commits of every metadata block are checked against their crcs, and
+ * every block found is claimed for the pair and id that refer to it,
+ * which finds blocks used twice, links to blocks that are not metadata
+ * and pairs nothing links to. Those orphans leak their blocks until the
+ * next write to the filesystem cleans them up.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lfs.h"
+#include "lfs_util.h"
+#include "bd/lfs_mmapbd.h"
+
+/* owner of a block: what it holds, the first block of the pair that
+ * refers to it and the id within that pair, 0 if free */
+enum { KIND_META = 1, KIND_DATA = 2, KIND_FRAG = 3 };
+#define OWNER(kind, pair, id) \
+    ((uint64_t) (kind) << 48 | (uint64_t) (pair) << 10 | (id))
+#define OWNER_KIND(o) ((unsigned) ((o) >> 48))
+#define OWNER_PAIR(o) ((lfs_block_t) ((o) >> 10))
+#define OWNER_ID(o) ((unsigned) ((o) & 0x3ff))
+#define NO_BLOCK ((lfs_block_t) -1)
+
+/* a pair found in the metadata list, or a link from one to another */
+typedef struct {
+    uint16_t type;
+    uint16_t id;
+    lfs_block_t from;
+    lfs_block_t to[2];
+} link_t;
+
+typedef struct {
+    pthread_t thread;
+    lfs_t lfs;
+    struct lfs_config cfg;
+    int err;
+
+    lfs_size_t pairs;
+    lfs_size_t commits;
+    lfs_size_t stale;
+    uint64_t mused;
+    lfs_size_t files;
+    lfs_block_t file[2];
+    bool handed; // passed on the tail of the pair we're in
+    link_t *links;
+    size_t nlinks, maxlinks;
+} job_t;
+
+static struct {
+    lfs_mmapbd_t bd;
+    const uint8_t *image;
+    lfs_size_t block_size;
+    lfs_block_t block_count;
+    lfs_size_t jobs;
+    uint64_t *owner;
+    uint8_t *linked;
+    unsigned problems;
+    pthread_mutex_t lock;
+
+    /* the next pair of the metadata list no job has taken yet, how many
+     * were handed out, and whether the list has ended */
+    pthread_cond_t more;
+    lfs_block_t next[2];
+    lfs_size_t handed;
+    bool done;
+} fsck = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .more = PTHREAD_COND_INITIALIZER,
+    .next = {0, 1},
+};
+
+static void problem(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static void problem(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    pthread_mutex_lock(&fsck.lock);
+    fsck.problems += 1;
+    vprintf(fmt, ap);
+    pthread_mutex_unlock(&fsck.lock);
+    va_end(ap);
+}
+
+/* walk the commits in a metadata block the way lfs_dir_fetch does,
+ * returning how many have a good crc and where the last one ends */
+static lfs_size_t check_commits(const uint8_t *b, lfs_off_t *end)
+{
+    lfs_size_t commits = 0;
+    lfs_off_t off = sizeof(uint32_t);
+    uint32_t ptag = 0xffffffff;
+    uint32_t crc = lfs_crc(0xffffffff, b, sizeof(uint32_t));
+    *end = 0;
+
+    while (off + sizeof(uint32_t) <= fsck.block_size) {
+        uint32_t tag;
+        memcpy(&tag, &b[off], sizeof(tag));
+        crc = lfs_crc(crc, &tag, sizeof(tag));
+        tag = lfs_frombe32(tag) ^ ptag;
+        lfs_size_t size = ((tag & 0x3ff) == 0x3ff) ? 0 : (tag & 0x3ff);
+        if ((tag & 0x80000000)
+                || off + sizeof(tag) + size > fsck.block_size) {
+            break;
+        }
+        ptag = tag;
+
+        if (((tag >> 20) & 0x700) == LFS_TYPE_CRC) {
+            uint32_t dcrc;
+            memcpy(&dcrc, &b[off + sizeof(tag)], sizeof(dcrc));
+            if (crc != lfs_fromle32(dcrc)) {
+                break;
+            }
+            ptag ^= ((tag >> 20) & 1) << 31;
+            crc = 0xffffffff;
+            commits += 1;
+            *end = off + sizeof(tag) + size;
+        } else {
+            crc = lfs_crc(crc, &b[off + sizeof(tag)], size);
+        }
+        off += sizeof(tag) + size;
+    }
+    return commits;
+}
+
+static void claim(const struct lfs_fsblock *info, unsigned kind)
+{
+    lfs_block_t pair = lfs_min(info->pair[0], info->pair[1]);
+    uint64_t want = OWNER(kind, pair, info->id);
+    uint64_t old = 0;
+    if (info->block >= fsck.block_count) {
+        problem("pair 0x%"PRIx32" id %u refers to block 0x%"PRIx32
+                " past the end\n", pair, info->id, info->block);
+        return;
+    }
+    if (__atomic_compare_exchange_n(&fsck.owner[info->block], &old, want,
+                false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    // small files share the blocks they are packed into
+    if (kind == KIND_FRAG && OWNER_KIND(old) == KIND_FRAG) {
+        return;
+    }
+    problem("block 0x%"PRIx32" used by pair 0x%"PRIx32" id %u "
+            "and by pair 0x%"PRIx32" id %u\n", info->block,
+            OWNER_PAIR(old), OWNER_ID(old), pair, info->id);
+}
+
+static int record(job_t *job, const struct lfs_fsblock *info)
+{
+    // both blocks of a pair come one after the other
+    if (job->nlinks == 0
+            || job->links[job->nlinks - 1].to[1] != NO_BLOCK) {
+        if (job->nlinks == job->maxlinks) {
+            size_t max = job->maxlinks ? 2 * job->maxlinks : 64;
+            link_t *links = realloc(job->links, max * sizeof(link_t));
+            if (!links) {
+                return LFS_ERR_NOMEM;
+            }
+            job->links = links;
+            job->maxlinks = max;
+        }
+        job->links[job->nlinks++] = (link_t) {
+            .type = info->type,
+            .id = info->id,
+            .from = lfs_min(info->pair[0], info->pair[1]),
+            .to = {info->block, NO_BLOCK},
+        };
+    } else {
+        job->links[job->nlinks - 1].to[1] = info->block;
+    }
+    return 0;
+}
+
+/* offer the next pair of the metadata list to the other jobs */
+static int hand_on(job_t *job, const lfs_block_t pair[2])
+{
+    int err = 0;
+    pthread_mutex_lock(&fsck.lock);
+    if (fsck.handed >= fsck.block_count / 2) {
+        /* the list loops */
+        err = LFS_ERR_CORRUPT;
+        fsck.done = true;
+    } else {
+        fsck.next[0] = pair[0];
+        fsck.next[1] = pair[1];
+        fsck.handed += 1;
+    }
+    pthread_cond_broadcast(&fsck.more);
+    pthread_mutex_unlock(&fsck.lock);
+    job->handed = true;
+    return err;
+}
+
+/* take the next pair of the metadata list, false once it has ended */
+static bool take(lfs_block_t pair[2])
+{
+    pthread_mutex_lock(&fsck.lock);
+    while (!fsck.done && fsck.next[0] == NO_BLOCK) {
+        pthread_cond_wait(&fsck.more, &fsck.lock);
+    }
+    bool taken = !fsck.done;
+    if (taken) {
+        pair[0] = fsck.next[0];
+        pair[1] = fsck.next[1];
+        fsck.next[0] = fsck.next[1] = NO_BLOCK;
+    }
+    pthread_mutex_unlock(&fsck.lock);
+    return taken;
+}
+
+/* no tail was handed on, the list has ended or can't go on */
+static void finish(void)
+{
+    pthread_mutex_lock(&fsck.lock);
+    fsck.done = true;
+    pthread_cond_broadcast(&fsck.more);
+    pthread_mutex_unlock(&fsck.lock);
+}
+
+static int visit(void *data, const struct lfs_fsblock *info)
+{
+    job_t *job = data;
+    switch (info->type) {
+    case LFS_TYPE_DIR: {
+        lfs_off_t end;
+        lfs_size_t commits = check_commits(
+                &fsck.image[(size_t) info->block * fsck.block_size], &end);
+        job->commits += commits;
+        job->stale += (commits == 0);
+        // the first block of the pair is the one in use
+        if (info->block == info->pair[0]) {
+            job->pairs += 1;
+            job->mused += end;
+        }
+        claim(info, KIND_META);
+        return record(job, info);
+    }
+    case LFS_TYPE_DIRSTRUCT:
+        if (info->block < fsck.block_count) {
+            __atomic_store_n(&fsck.linked[info->block], 1,
+                    __ATOMIC_RELAXED);
+        }
+        return record(job, info);
+    case LFS_TYPE_HARDTAIL:
+        if (info->block < fsck.block_count) {
+            __atomic_store_n(&fsck.linked[info->block], 1,
+                    __ATOMIC_RELAXED);
+        }
+        /* fall through */
+    case LFS_TYPE_SOFTTAIL: {
+        int err = record(job, info);
+        const link_t *l = &job->links[job->nlinks - 1];
+        if (!err && info->id == 0x3ff && l->to[1] != NO_BLOCK) {
+            err = hand_on(job, l->to);
+        }
+        return err;
+    }
+    default:
+        if (info->pair[0] != job->file[0] || info->id != job->file[1]) {
+            job->files += 1;
+            job->file[0] = info->pair[0];
+            job->file[1] = info->id;
+        }
+        claim(info, (info->type == LFS_TYPE_FRAGSTRUCT)
+                ? KIND_FRAG : KIND_DATA);
+        return 0;
+    }
+}
+
+static void *run(void *arg)
+{
+    job_t *job = arg;
+    job->file[0] = NO_BLOCK;
+    job->err = lfs_mount(&job->lfs, &job->cfg);
+    if (job->err) {
+        finish();
+        return NULL;
+    }
+    lfs_block_t pair[2];
+    while (take(pair)) {
+        job->handed = false;
+        job->err = lfs_fs_traverseinfo(&job->lfs, pair, visit, job);
+        if (job->err || !job->handed) {
+            finish();
+        }
+        if (job->err) {
+            break;
+        }
+    }
+    lfs_unmount(&job->lfs);
+    return NULL;
+}
+
+/* block size from the superblock, which is always the first entry in
+ * block 0 (see SPEC.md), 0 if there is none */
+static lfs_size_t stored_geometry(const uint8_t *b, size_t size,
+        lfs_block_t *count)
+{
+    uint32_t tag, word, bs;
+    if (size < 32 || memcmp(&b[8], "littlefs", 8) != 0) {
+        return 0;
+    }
+    memcpy(&tag, &b[4], 4);
+    tag = lfs_frombe32(tag) ^ 0xffffffff;
+    memcpy(&word, &b[16], 4);
+    tag ^= lfs_frombe32(word);
+    if ((tag & 0x80000000) || ((tag >> 20) & 0x7ff) != LFS_TYPE_INLINESTRUCT
+            || (tag & 0x3ff) != 24) {
+        return 0;
+    }
+    memcpy(&bs, &b[24], 4);
+    memcpy(count, &b[28], 4);
+    *count = lfs_fromle32(*count);
+    return lfs_fromle32(bs);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: lfsck [-j jobs] [-b block_size] image\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    lfs_size_t block_size = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:b:")) != -1) {
+        switch (opt) {
+        case 'j': jobs = strtol(optarg, NULL, 0); break;
+        case 'b': block_size = strtoul(optarg, NULL, 0); break;
+        default: usage();
+        }
+    }
+    if (optind + 1 != argc || jobs < 1) {
+        usage();
+    }
+    const char *path = argv[optind];
+
+    struct stat st;
+    FILE *f = fopen(path, "rb");
+    uint8_t head[32];
+    lfs_block_t block_count = 0;
+    if (!f || fstat(fileno(f), &st) != 0) {
+        fprintf(stderr, "lfsck: %s: %s\n", path, strerror(errno));
+        return 2;
+    }
+    size_t n = fread(head, 1, sizeof(head), f);
+    fclose(f);
+    lfs_size_t stored = stored_geometry(head, n, &block_count);
+    if (!block_size) {
+        block_size = stored;
+    }
+    if (!block_size || block_size < 128 || (block_size & (block_size - 1))) {
+        fprintf(stderr, "lfsck: %s: no superblock, pass -b block_size\n",
+                path);
+        return 2;
+    }
+    if (stored != block_size || (uint64_t) block_count * block_size
+            > (uint64_t) st.st_size) {
+        block_count = st.st_size / block_size;
+    }
+
+    fsck.block_size = block_size;
+    fsck.block_count = block_count;
+    fsck.jobs = jobs;
+    const struct lfs_mmapbd_config bdcfg = {
+        .erase_value = -1,
+        .readonly = true,
+    };
+    struct lfs_config cfg = {
+        .context = &fsck.bd,
+        .read = lfs_mmapbd_read,
+        .prog = lfs_mmapbd_prog,
+        .erase = lfs_mmapbd_erase,
+        .sync = lfs_mmapbd_sync,
+        .read_size = 16,
+        .prog_size = 16,
+        .block_size = block_size,
+        .block_count = block_count,
+        .block_cycles = -1,
+        .cache_size = lfs_min(block_size, 512),
+        .lookahead_size = 16,
+    };
+    int err = lfs_mmapbd_createcfg(&cfg, path, &bdcfg);
+    if (err) {
+        fprintf(stderr, "lfsck: %s: can't map image (%d)\n", path, err);
+        return 2;
+    }
+    fsck.image = fsck.bd.buffer;
+    fsck.owner = calloc(block_count, sizeof(*fsck.owner));
+    fsck.linked = calloc(block_count, 1);
+    job_t *job = calloc(jobs, sizeof(job_t));
+    uint8_t *orphan = calloc(block_count, 1);
+    if (!fsck.owner || !fsck.linked || !job || !orphan) {
+        fprintf(stderr, "lfsck: out of memory\n");
+        return 2;
+    }
+    printf("%s: %"PRIu32" blocks of %"PRIu32" bytes, %ld jobs\n",
+            path, block_count, block_size, jobs);
+
+    // every job reads the image through its own mount
+    for (long i = 0; i < jobs; ++i) {
+        job[i].cfg = cfg;
+        if (pthread_create(&job[i].thread, NULL, run, &job[i]) != 0) {
+            fprintf(stderr, "lfsck: can't start job %ld\n", i);
+            return 2;
+        }
+    }
+    int failed = 0;
+    lfs_size_t pairs = 0, commits = 0, stale = 0, files = 0;
+    uint64_t mused = 0;
+    for (long i = 0; i < jobs; ++i) {
+        pthread_join(job[i].thread, NULL);
+        if (job[i].err) {
+            fprintf(stderr, "lfsck: job %ld failed (%d)\n", i, job[i].err);
+            failed = 1;
+        }
+        pairs += job[i].pairs;
+        commits += job[i].commits;
+        stale += job[i].stale;
+        files += job[i].files;
+        mused += job[i].mused;
+    }
+    if (failed) {
+        return 2;
+    }
+
+    // links must point at both blocks of a pair in the metadata list, and
+    // pairs nothing links to, and everything they hold, are leaked
+    lfs_size_t orphans = 0;
+    for (long i = 0; i < jobs; ++i) {
+        for (size_t j = 0; j < job[i].nlinks; ++j) {
+            const link_t *l = &job[i].links[j];
+            if (l->type == LFS_TYPE_DIR) {
+                if (l->from != 0 && !fsck.linked[l->to[0]]
+                        && !fsck.linked[l->to[1]]) {
+                    orphan[l->from] = 1;
+                    orphans += 1;
+                }
+                continue;
+            }
+
+            uint64_t o[2] = {0, 0};
+            for (int k = 0; k < 2; ++k) {
+                if (l->to[k] < block_count) {
+                    o[k] = fsck.owner[l->to[k]];
+                }
+            }
+            lfs_block_t to = lfs_min(l->to[0], l->to[1]);
+            if (OWNER_KIND(o[0]) != KIND_META || o[0] != o[1]
+                    || OWNER_PAIR(o[0]) != to) {
+                problem("pair 0x%"PRIx32" id %u links to {0x%"PRIx32
+                        ", 0x%"PRIx32"}, which is not a metadata pair\n",
+                        l->from, l->id, l->to[0], l->to[1]);
+            }
+        }
+        free(job[i].links);
+    }
+
+    lfs_size_t meta = 0, data = 0, frag = 0, runs = 0, leaked = 0;
+    lfs_size_t free_blocks = 0, free_runs = 0, largest = 0, run = 0;
+    for (lfs_block_t b = 0; b < block_count; ++b) {
+        uint64_t o = fsck.owner[b];
+        switch (OWNER_KIND(o)) {
+        case KIND_META: meta += 1; break;
+        case KIND_FRAG: frag += 1; break;
+        case KIND_DATA:
+            data += 1;
+            runs += (b == 0 || fsck.owner[b - 1] != o);
+            break;
+        }
+        if (o) {
+            leaked += orphan[OWNER_PAIR(o)];
+            run = 0;
+        } else {
+            free_blocks += 1;
+            free_runs += (run == 0);
+            run += 1;
+            largest = lfs_max(largest, run);
+        }
+    }
+    free(orphan);
+
+    printf("metadata: %"PRIu32" pairs, %"PRIu32" commits, "
+            "%"PRIu32" blocks with no valid commit, %.0f%% full\n",
+            pairs, commits, stale,
+            pairs ? 100.0 * mused / ((uint64_t) pairs * block_size) : 0.0);
+    printf("data: %"PRIu32" files, %"PRIu32" blocks in %"PRIu32" runs "
+            "(%.1f blocks per run), %"PRIu32" shared fragment blocks\n",
+            files, data, runs, runs ? (double) data / runs : 0.0, frag);
+    printf("free: %"PRIu32" blocks in %"PRIu32" runs, largest %"PRIu32
+            " blocks\n", free_blocks, free_runs, largest);
+    printf("used: %"PRIu32" of %"PRIu32" blocks (%.1f%%)\n",
+            meta + data + frag, block_count,
+            100.0 * (meta + data + frag) / block_count);
+    printf("orphans: %"PRIu32" pairs leaking %"PRIu32" blocks "
+            "until the next write\n", orphans, leaked);
+    printf("problems: %u\n", fsck.problems);
+
+    lfs_mmapbd_destroy(&cfg);
+    free(fsck.owner);
+    free(fsck.linked);
+    free(job);
+    return fsck.problems ? 1 : 0;
+}
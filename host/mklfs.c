@@ -0,0 +1,569 @@
+/*
+ * Builds a littlefs image from a directory tree on the host, for
+ * preloading cards.
+ *
+ * usage: mklfs [-j jobs] [-b block_size] [-r read_size] [-p prog_size]
+ *              [-c cache_size] [-k pack_max] [-m manifest] [-V]
+ *              -s size dir image
+ * Sizes take a k, M or G suffix. The defaults match what the sdmmc glue
+ * picks for a card with 512 byte sectors.
+ *
+ * The image is laid out in one pass over a fresh memory-mapped file:
+ * - the files in a directory are created a transaction at a time and
+ *   written a group at a time, so a metadata pair sees two commits for
+ *   every group of files rather than two for every file
+ * - each file is written with one lfs_file_write straight from its
+ *   contents, in order on an empty filesystem, so its blocks are
+ *   contiguous
+ * - nothing is read back, erases are not simulated and the mapping is
+ *   left for the OS to write back
+ * While one thread builds the image, jobs threads map the files ahead of
+ * it, pulling them into memory and taking their crc for the manifest.
+ * With -V the finished image is mounted once per job and every file is
+ * read back and checked against its crc.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lfs.h"
+#include "lfs_util.h"
+#include "bd/lfs_mmapbd.h"
+
+/* files in a transaction, each create takes 3 of the LFS_TX_MAX attrs */
+#define GROUP (LFS_TX_MAX / 3)
+/* how far the loaders may get ahead of the builder */
+#define AHEAD_BYTES (64 * 1024 * 1024)
+
+typedef struct {
+    char *path;     /* in the image, "/a/b" */
+    char *src;      /* on the host */
+    bool dir;
+    size_t size;
+    uint32_t crc;
+    void *data;
+    int state;      /* 0 waiting, 1 loading, 2 loaded, -errno on error */
+} entry_t;
+
+static struct {
+    entry_t *entries;
+    size_t count, max;
+    size_t next;    /* next entry for a loader */
+    size_t written; /* entries the builder is done with */
+    uint64_t ahead; /* bytes loaded but not yet written */
+    pthread_mutex_t lock;
+    pthread_cond_t loaded, consumed;
+} mk = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .loaded = PTHREAD_COND_INITIALIZER,
+    .consumed = PTHREAD_COND_INITIALIZER,
+};
+
+static int add(const char *path, const char *src, bool dir, size_t size)
+{
+    if (mk.count == mk.max) {
+        size_t max = mk.max ? 2 * mk.max : 256;
+        entry_t *entries = realloc(mk.entries, max * sizeof(entry_t));
+        if (!entries) {
+            return -ENOMEM;
+        }
+        mk.entries = entries;
+        mk.max = max;
+    }
+    entry_t *e = &mk.entries[mk.count];
+    *e = (entry_t) {
+        .path = strdup(path),
+        .src = strdup(src),
+        .dir = dir,
+        .size = size,
+    };
+    if (!e->path || !e->src) {
+        return -ENOMEM;
+    }
+    mk.count += 1;
+    return 0;
+}
+
+/* list a directory's files, then recurse into its subdirectories, in
+ * name order so images come out the same every time */
+static int scan(const char *path, const char *src)
+{
+    struct dirent **names;
+    int n = scandir(src, &names, NULL, alphasort);
+    if (n < 0) {
+        int err = -errno;
+        fprintf(stderr, "mklfs: %s: %s\n", src, strerror(-err));
+        return err;
+    }
+
+    int err = 0;
+    for (int pass = 0; pass < 2 && !err; ++pass) {
+        for (int i = 0; i < n && !err; ++i) {
+            const char *name = names[i]->d_name;
+            if (!strcmp(name, ".") || !strcmp(name, "..")) {
+                continue;
+            }
+            char *p, *s;
+            if (asprintf(&p, "%s/%s", path, name) < 0) {
+                p = NULL;
+            }
+            if (asprintf(&s, "%s/%s", src, name) < 0) {
+                s = NULL;
+            }
+            struct stat st;
+            if (!p || !s) {
+                err = -ENOMEM;
+            } else if (stat(s, &st) != 0) {
+                err = -errno;
+                fprintf(stderr, "mklfs: %s: %s\n", s, strerror(-err));
+            } else if (pass == 0 && S_ISREG(st.st_mode)) {
+                err = add(p, s, false, st.st_size);
+            } else if (pass == 1 && S_ISDIR(st.st_mode)) {
+                err = add(p, s, true, 0);
+                if (!err) {
+                    err = scan(p, s);
+                }
+            } else if (pass == 0 && !S_ISDIR(st.st_mode)) {
+                fprintf(stderr, "mklfs: %s: skipping special file\n", s);
+            }
+            free(p);
+            free(s);
+        }
+    }
+
+    for (int i = 0; i < n; ++i) {
+        free(names[i]);
+    }
+    free(names);
+    return err;
+}
+
+/* map a file and take its crc, which also pulls it into memory */
+static int load(entry_t *e)
+{
+    e->crc = lfs_crc(0xffffffff, NULL, 0);
+    if (e->size == 0) {
+        return 0;
+    }
+    int fd = open(e->src, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+    e->data = mmap(NULL, e->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = (e->data == MAP_FAILED) ? -errno : 0;
+    close(fd);
+    if (err) {
+        e->data = NULL;
+        return err;
+    }
+    e->crc = lfs_crc(e->crc, e->data, e->size);
+    return 0;
+}
+
+static void *loader(void *arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&mk.lock);
+    while (mk.next < mk.count) {
+        entry_t *e = &mk.entries[mk.next++];
+        if (e->dir) {
+            e->state = 2;
+            continue;
+        }
+        // stay within reach of the builder
+        while (mk.ahead > AHEAD_BYTES && e - mk.entries > (long) mk.written) {
+            pthread_cond_wait(&mk.consumed, &mk.lock);
+        }
+        mk.ahead += e->size;
+        e->state = 1;
+        pthread_mutex_unlock(&mk.lock);
+
+        int err = load(e);
+
+        pthread_mutex_lock(&mk.lock);
+        e->state = err ? err : 2;
+        pthread_cond_broadcast(&mk.loaded);
+    }
+    pthread_mutex_unlock(&mk.lock);
+    return NULL;
+}
+
+static int wait_loaded(entry_t *e)
+{
+    pthread_mutex_lock(&mk.lock);
+    while (e->state == 0 || e->state == 1) {
+        pthread_cond_wait(&mk.loaded, &mk.lock);
+    }
+    int state = e->state;
+    pthread_mutex_unlock(&mk.lock);
+    if (state < 0) {
+        fprintf(stderr, "mklfs: %s: %s\n", e->src, strerror(-state));
+        return state;
+    }
+    return 0;
+}
+
+static void done(size_t i)
+{
+    entry_t *e = &mk.entries[i];
+    if (e->data) {
+        munmap(e->data, e->size);
+        e->data = NULL;
+    }
+    pthread_mutex_lock(&mk.lock);
+    mk.written = i + 1;
+    mk.ahead -= e->size;
+    pthread_cond_broadcast(&mk.consumed);
+    pthread_mutex_unlock(&mk.lock);
+}
+
+/* create, write and commit a group of files from the same directory */
+static int build_group(lfs_t *lfs, size_t first, size_t count)
+{
+    lfs_tx_t tx;
+    int err = lfs_tx_begin(lfs, &tx);
+    for (size_t i = first; i < first + count && !err; ++i) {
+        err = lfs_tx_create(lfs, &tx, mk.entries[i].path);
+        if (err == LFS_ERR_INVAL) {
+            // a big directory split over several metadata pairs takes one
+            // transaction per pair
+            err = lfs_tx_commit(lfs, &tx);
+            if (!err) {
+                err = lfs_tx_create(lfs, &tx, mk.entries[i].path);
+            }
+        }
+    }
+    if (!err) {
+        err = lfs_tx_commit(lfs, &tx);
+    }
+    if (err) {
+        return err;
+    }
+
+    lfs_file_t files[GROUP];
+    size_t nopen = 0;
+    for (size_t i = first; i < first + count && !err; ++i) {
+        entry_t *e = &mk.entries[i];
+        err = wait_loaded(e);
+        if (err) {
+            break;
+        }
+        err = lfs_file_open(lfs, &files[nopen], e->path, LFS_O_WRONLY);
+        if (err) {
+            break;
+        }
+        nopen += 1;
+        lfs_ssize_t res = lfs_file_write(lfs, &files[nopen - 1],
+                e->data, e->size);
+        if (res >= 0 && (size_t) res != e->size) {
+            res = LFS_ERR_NOSPC;
+        }
+        err = (res < 0) ? (int) res : 0;
+    }
+
+    // one commit per metadata pair for the whole group
+    if (!err) {
+        err = lfs_fs_sync(lfs);
+    }
+    for (size_t i = 0; i < nopen; ++i) {
+        int cerr = lfs_file_close(lfs, &files[i]);
+        err = err ? err : cerr;
+        done(first + i);
+    }
+    return err;
+}
+
+static int build(lfs_t *lfs)
+{
+    size_t i = 0;
+    while (i < mk.count) {
+        entry_t *e = &mk.entries[i];
+        if (e->dir) {
+            int err = lfs_mkdir(lfs, e->path);
+            if (err) {
+                fprintf(stderr, "mklfs: %s: can't create (%d)\n",
+                        e->path, err);
+                return err;
+            }
+            done(i);
+            i += 1;
+            continue;
+        }
+
+        // files of one directory come one after the other
+        size_t n = 1;
+        const char *slash = strrchr(e->path, '/');
+        while (n < GROUP && i + n < mk.count && !mk.entries[i + n].dir) {
+            const char *other = strrchr(mk.entries[i + n].path, '/');
+            if (other - mk.entries[i + n].path != slash - e->path
+                    || strncmp(e->path, mk.entries[i + n].path,
+                        slash - e->path) != 0) {
+                break;
+            }
+            n += 1;
+        }
+        int err = build_group(lfs, i, n);
+        if (err) {
+            fprintf(stderr, "mklfs: %s: can't write (%d)\n", e->path, err);
+            return err;
+        }
+        i += n;
+    }
+    return 0;
+}
+
+typedef struct {
+    pthread_t thread;
+    lfs_t lfs;
+    struct lfs_config cfg;
+    size_t index, stride;
+    unsigned bad;
+    int err;
+} checker_t;
+
+/* read every stride-th file back and compare its crc */
+static void *check(void *arg)
+{
+    checker_t *c = arg;
+    uint8_t *buf = malloc(c->cfg.block_size);
+    c->err = buf ? lfs_mount(&c->lfs, &c->cfg) : LFS_ERR_NOMEM;
+    if (c->err) {
+        free(buf);
+        return NULL;
+    }
+    for (size_t i = c->index; i < mk.count; i += c->stride) {
+        entry_t *e = &mk.entries[i];
+        if (e->dir) {
+            continue;
+        }
+        lfs_file_t file;
+        uint32_t crc = lfs_crc(0xffffffff, NULL, 0);
+        size_t size = 0;
+        int err = lfs_file_open(&c->lfs, &file, e->path, LFS_O_RDONLY);
+        if (!err) {
+            while (true) {
+                lfs_ssize_t res = lfs_file_read(&c->lfs, &file, buf,
+                        c->cfg.block_size);
+                if (res <= 0) {
+                    err = res;
+                    break;
+                }
+                crc = lfs_crc(crc, buf, res);
+                size += res;
+            }
+            lfs_file_close(&c->lfs, &file);
+        }
+        if (err || size != e->size || crc != e->crc) {
+            fprintf(stderr, "mklfs: %s: reads back wrong (%d)\n",
+                    e->path, err);
+            c->bad += 1;
+        }
+    }
+    lfs_unmount(&c->lfs);
+    free(buf);
+    return NULL;
+}
+
+static uint64_t parse_size(const char *s)
+{
+    char *end;
+    uint64_t v = strtoull(s, &end, 0);
+    switch (*end) {
+    case 'G': v <<= 10; // fallthrough
+    case 'M': v <<= 10; // fallthrough
+    case 'k': v <<= 10; break;
+    }
+    return v;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mklfs [-j jobs] [-b block_size] "
+            "[-r read_size] [-p prog_size]\n"
+            "             [-c cache_size] [-k pack_max] [-m manifest] "
+            "[-V] -s size dir image\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    lfs_size_t block_size = 8192, read_size = 512, prog_size = 512;
+    lfs_size_t cache_size = 512, pack_max = 0;
+    uint64_t size = 0;
+    const char *manifest = NULL;
+    bool verify = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:b:r:p:c:k:m:s:V")) != -1) {
+        switch (opt) {
+        case 'j': jobs = strtol(optarg, NULL, 0); break;
+        case 'b': block_size = parse_size(optarg); break;
+        case 'r': read_size = parse_size(optarg); break;
+        case 'p': prog_size = parse_size(optarg); break;
+        case 'c': cache_size = parse_size(optarg); break;
+        case 'k': pack_max = parse_size(optarg); break;
+        case 'm': manifest = optarg; break;
+        case 's': size = parse_size(optarg); break;
+        case 'V': verify = true; break;
+        default: usage();
+        }
+    }
+    if (optind + 2 != argc || jobs < 1 || !size
+            || !block_size || size / block_size < 2
+            || size / block_size > 0xfffffff0) {
+        usage();
+    }
+    const char *src = argv[optind];
+    const char *image = argv[optind + 1];
+    lfs_block_t block_count = size / block_size;
+
+    int err = scan("", src);
+    if (err) {
+        return 1;
+    }
+
+    // start from an empty sparse file, nothing needs erasing
+    int fd = open(image, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "mklfs: %s: %s\n", image, strerror(errno));
+        return 1;
+    }
+    close(fd);
+
+    lfs_mmapbd_t bd;
+    const struct lfs_mmapbd_config bdcfg = {.erase_value = -1};
+    // the whole image fits in the lookahead, so it is scanned once
+    lfs_size_t lookahead = lfs_min(((block_count + 63) / 64) * 8, 1 << 20);
+    struct lfs_config cfg = {
+        .context = &bd,
+        .read = lfs_mmapbd_read,
+        .prog = lfs_mmapbd_prog,
+        .erase = lfs_mmapbd_erase,
+        .sync = lfs_mmapbd_sync,
+        .read_size = read_size,
+        .prog_size = prog_size,
+        .block_size = block_size,
+        .block_count = block_count,
+        .block_cycles = -1,
+        .cache_size = cache_size,
+        .lookahead_size = lookahead,
+        .verify = LFS_VERIFY_NEVER,
+        .compact_size = lfs_min(block_size / 2, 8192),
+        .index_size = lfs_min(block_size / 2, 8192),
+        .pack_max = pack_max,
+    };
+    err = lfs_mmapbd_createcfg(&cfg, image, &bdcfg);
+    if (err) {
+        fprintf(stderr, "mklfs: %s: can't map image (%d)\n", image, err);
+        return 1;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_t *loaders = calloc(jobs, sizeof(pthread_t));
+    for (long i = 0; i < jobs; ++i) {
+        if (pthread_create(&loaders[i], NULL, loader, NULL) != 0) {
+            fprintf(stderr, "mklfs: can't start job %ld\n", i);
+            return 1;
+        }
+    }
+
+    lfs_t lfs;
+    err = lfs_format(&lfs, &cfg);
+    if (!err) {
+        err = lfs_mount(&lfs, &cfg);
+    }
+    if (!err) {
+        err = build(&lfs);
+        lfs_ssize_t used = lfs_fs_size(&lfs);
+        int uerr = lfs_unmount(&lfs);
+        err = err ? err : (used < 0) ? (int) used : uerr;
+        if (!err) {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            uint64_t bytes = 0;
+            size_t files = 0;
+            for (size_t i = 0; i < mk.count; ++i) {
+                bytes += mk.entries[i].size;
+                files += !mk.entries[i].dir;
+            }
+            double s = (t1.tv_sec - t0.tv_sec)
+                    + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+            printf("%s: %zu files, %zu directories, %"PRIu64" bytes "
+                    "in %.2f s (%.1f MB/s), %"PRId32" of %"PRIu32
+                    " blocks used\n", image, files, mk.count - files,
+                    bytes, s, bytes / s / 1e6, used, block_count);
+        }
+    }
+    if (err) {
+        fprintf(stderr, "mklfs: %s: failed (%d)\n", image, err);
+    }
+
+    // a failed build leaves loaders waiting on the builder
+    pthread_mutex_lock(&mk.lock);
+    mk.written = mk.count;
+    mk.next = mk.count;
+    pthread_cond_broadcast(&mk.consumed);
+    pthread_mutex_unlock(&mk.lock);
+    for (long i = 0; i < jobs; ++i) {
+        pthread_join(loaders[i], NULL);
+    }
+    free(loaders);
+
+    if (!err && verify) {
+        // each job mounts the image on its own to read its share
+        checker_t *c = calloc(jobs, sizeof(checker_t));
+        unsigned bad = c ? 0 : 1;
+        for (long i = 0; i < jobs && c; ++i) {
+            c[i].cfg = cfg;
+            c[i].index = i;
+            c[i].stride = jobs;
+            if (pthread_create(&c[i].thread, NULL, check, &c[i]) != 0) {
+                c[i].err = LFS_ERR_NOMEM;
+                c[i].thread = 0;
+            }
+        }
+        for (long i = 0; i < jobs && c; ++i) {
+            if (c[i].thread) {
+                pthread_join(c[i].thread, NULL);
+            }
+            bad += c[i].bad + (c[i].err != 0);
+        }
+        free(c);
+        if (bad) {
+            fprintf(stderr, "mklfs: %s: %u files failed to verify\n",
+                    image, bad);
+            err = LFS_ERR_CORRUPT;
+        }
+    }
+
+    if (!err && manifest) {
+        FILE *f = fopen(manifest, "w");
+        for (size_t i = 0; f && i < mk.count; ++i) {
+            if (!mk.entries[i].dir) {
+                fprintf(f, "%08"PRIx32" %zu %s\n", mk.entries[i].crc,
+                        mk.entries[i].size, mk.entries[i].path);
+            }
+        }
+        if (!f || fclose(f) != 0) {
+            fprintf(stderr, "mklfs: %s: %s\n", manifest, strerror(errno));
+            err = LFS_ERR_IO;
+        }
+    }
+
+    lfs_mmapbd_destroy(&cfg);
+    for (size_t i = 0; i < mk.count; ++i) {
+        free(mk.entries[i].path);
+        free(mk.entries[i].src);
+    }
+    free(mk.entries);
+    return err ? 1 : 0;
+}
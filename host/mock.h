@@ -0,0 +1,96 @@
+#ifndef _HOST_MOCK_H
+#define _HOST_MOCK_H
+/*
+ * Host-side stand-ins for the esp-idf sdmmc driver, heap, locks and VFS,
+ * so the esp_littlefs glue can be built and exercised on Linux.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+/* mock_sdmmc.c: the simulated card, backed by RAM or an image file */
+struct mock_sdmmc_config {
+    uint32_t capacity; // in sectors
+    uint32_t sector_size;
+    uint32_t read_block_len; // log2 of the CSD read block length
+    const char *path; // image file, NULL keeps the card in RAM
+
+    /* model malloc returning SPI RAM, as with CONFIG_SPIRAM_USE_MALLOC.
+     * Only heap_caps_malloc(MALLOC_CAP_DMA) memory is then DMA-capable,
+     * otherwise every buffer is. */
+    bool spiram_malloc;
+
+    /* timing model behind esp_timer_get_time, all zero makes transfers
+     * take no time */
+    uint32_t cmd_us; // per read or write command
+    uint32_t read_us; // per sector read
+    uint32_t page_size; // flash page, writes are done in whole pages
+    uint32_t page_us; // per page written
+    uint32_t au_size; // allocation unit reported in the SD status, bytes
+};
+
+int mock_sdmmc_setup(const struct mock_sdmmc_config *cfg);
+void mock_sdmmc_teardown(void);
+
+/* transfer sizes are bucketed by log2 of the sector count */
+#define MOCK_HIST_BUCKETS 16
+
+struct mock_stats {
+    /* sdmmc commands and sectors moved */
+    uint32_t reads;
+    uint32_t writes;
+    uint64_t read_sectors;
+    uint64_t write_sectors;
+    uint32_t read_hist[MOCK_HIST_BUCKETS];
+    uint32_t write_hist[MOCK_HIST_BUCKETS];
+
+    /* transfers from buffers that are not 4-byte aligned */
+    uint32_t unaligned;
+
+    /* transfers the real driver would split into single-sector commands
+     * through a temporary DMA buffer, because the caller's buffer is not
+     * DMA-capable or is unaligned */
+    uint32_t bounced;
+    uint64_t bounced_sectors;
+
+    /* simulated time spent in transfers */
+    uint64_t busy_us;
+
+    /* heap_caps allocations */
+    uint32_t dma_allocs;
+    uint32_t dma_frees;
+    uint64_t dma_bytes;
+};
+
+const struct mock_stats *mock_stats(void);
+extern struct mock_stats mock_counters; /* updated by the mocks */
+void mock_stats_reset(void);
+void mock_stats_print(const char *title);
+
+/* mock_sys.c: heap_caps bookkeeping */
+bool mock_heap_dma_capable(const void *ptr);
+
+/* mock_vfs.c: call into registered VFS drivers like the newlib POSIX API */
+int mock_vfs_open(const char *path, int flags, int mode);
+ssize_t mock_vfs_read(int fd, void *dst, size_t size);
+ssize_t mock_vfs_write(int fd, const void *src, size_t size);
+off_t mock_vfs_lseek(int fd, off_t offset, int mode);
+int mock_vfs_fsync(int fd);
+int mock_vfs_fstat(int fd, struct stat *st);
+int mock_vfs_close(int fd);
+int mock_vfs_stat(const char *path, struct stat *st);
+int mock_vfs_unlink(const char *path);
+int mock_vfs_rename(const char *src, const char *dst);
+int mock_vfs_mkdir(const char *path, mode_t mode);
+int mock_vfs_rmdir(const char *path);
+int mock_vfs_truncate(const char *path, off_t length);
+DIR *mock_vfs_opendir(const char *path);
+struct dirent *mock_vfs_readdir(DIR *dir);
+int mock_vfs_readdir_r(DIR *dir, struct dirent *entry, struct dirent **out);
+long mock_vfs_telldir(DIR *dir);
+void mock_vfs_seekdir(DIR *dir, long offset);
+int mock_vfs_closedir(DIR *dir);
+
+#endif
@@ -0,0 +1,264 @@
+/*
+ * Host stand-in for the esp-idf sdmmc host driver and card protocol layer.
+ * The card is a RAM buffer or an image file, and every transfer is counted
+ * in mock_counters.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_memory_utils.h"
+#include "driver/sdmmc_host.h"
+#include "sdmmc_cmd.h"
+#include "mock.h"
+
+static const char *TAG = "mock_sdmmc";
+
+static struct mock_sdmmc_config card_cfg;
+static uint8_t *card_ram = NULL;
+static size_t card_ram_size = 0;
+static int card_fd = -1;
+static int64_t card_clock = 0;
+
+struct mock_stats mock_counters;
+
+int mock_sdmmc_setup(const struct mock_sdmmc_config *cfg)
+{
+    mock_sdmmc_teardown();
+    card_cfg = *cfg;
+    if (cfg->path) {
+        card_fd = open(cfg->path, O_RDWR | O_CREAT, 0666);
+        if (card_fd < 0) {
+            return -errno;
+        }
+        if (ftruncate(card_fd, (off_t) cfg->capacity * cfg->sector_size)) {
+            int err = -errno;
+            close(card_fd);
+            card_fd = -1;
+            return err;
+        }
+    } else {
+        /* pages are only backed once touched, so large cards are cheap */
+        card_ram_size = (size_t) cfg->capacity * cfg->sector_size;
+        void *ram = mmap(NULL, card_ram_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ram == MAP_FAILED) {
+            return -ENOMEM;
+        }
+        card_ram = ram;
+    }
+    mock_stats_reset();
+    return 0;
+}
+
+void mock_sdmmc_teardown(void)
+{
+    if (card_ram) {
+        munmap(card_ram, card_ram_size);
+        card_ram = NULL;
+    }
+    if (card_fd >= 0) {
+        close(card_fd);
+        card_fd = -1;
+    }
+}
+
+/* host driver */
+esp_err_t sdmmc_host_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t sdmmc_host_deinit(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t sdmmc_host_init_slot(int slot, const sdmmc_slot_config_t *slot_config)
+{
+    (void) slot;
+    (void) slot_config;
+    return ESP_OK;
+}
+
+/* card protocol layer */
+esp_err_t sdmmc_card_init(const sdmmc_host_t *host, sdmmc_card_t *card)
+{
+    if (!card_ram && card_fd < 0) {
+        ESP_LOGE(TAG, "no card, call mock_sdmmc_setup first");
+        return ESP_ERR_NOT_FOUND;
+    }
+    memset(card, 0, sizeof(*card));
+    card->host = *host;
+    card->ocr = 0x40ff8000;
+    card->rca = 1;
+    card->max_freq_khz = host->max_freq_khz;
+    card->is_mem = 1;
+    card->log_bus_width = (host->flags & SDMMC_HOST_FLAG_4BIT) ? 2 : 0;
+    card->csd.csd_ver = 1;
+    card->csd.capacity = card_cfg.capacity;
+    card->csd.sector_size = card_cfg.sector_size;
+    card->csd.read_block_len = card_cfg.read_block_len;
+    card->csd.card_command_class = 0x5b5;
+    card->csd.tr_speed = 25000000;
+    memcpy(card->cid.name, "MOCKSD", 6);
+    card->cid.serial = 1;
+    card->scr.sd_spec = 2;
+    card->scr.bus_width = 5;
+    card->ssr.alloc_unit_kb = card_cfg.au_size / 1024;
+    return ESP_OK;
+}
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card)
+{
+    fprintf(stream, "Name: %.8s\n", card->cid.name);
+    fprintf(stream, "Type: SDHC/SDXC (mock)\n");
+    fprintf(stream, "Size: %lluMB\n", ((unsigned long long) card->csd.capacity)
+            * card->csd.sector_size / (1024 * 1024));
+}
+
+static unsigned hist_bucket(size_t count)
+{
+    unsigned b = 0;
+    while (count > 1 && b < MOCK_HIST_BUCKETS - 1) {
+        count >>= 1;
+        b++;
+    }
+    return b;
+}
+
+bool esp_ptr_dma_capable(const void *p)
+{
+    return !card_cfg.spiram_malloc || mock_heap_dma_capable(p);
+}
+
+/* would the real driver need to bounce this buffer through a temporary
+ * DMA-capable sector buffer? */
+static void count_buffer(const void *buf, size_t count)
+{
+    bool unaligned = ((uintptr_t) buf % 4) != 0;
+    bool dma = esp_ptr_dma_capable(buf);
+    if (unaligned) {
+        mock_counters.unaligned++;
+    }
+    if (unaligned || !dma) {
+        mock_counters.bounced++;
+        mock_counters.bounced_sectors += count;
+    }
+}
+
+/* the simulated clock only moves with card transfers */
+int64_t esp_timer_get_time(void)
+{
+    return card_clock;
+}
+
+static void spend(uint64_t us)
+{
+    card_clock += us;
+    mock_counters.busy_us += us;
+}
+
+static esp_err_t check_range(sdmmc_card_t *card, size_t start, size_t count)
+{
+    if (start + count > (size_t) card->csd.capacity) {
+        ESP_LOGE(TAG, "transfer %zu+%zu out of range", start, count);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t sdmmc_read_sectors(sdmmc_card_t *card, void *dst,
+        size_t start_sector, size_t sector_count)
+{
+    esp_err_t e = check_range(card, start_sector, sector_count);
+    if (e != ESP_OK || sector_count == 0) {
+        return e;
+    }
+    mock_counters.reads++;
+    mock_counters.read_sectors += sector_count;
+    mock_counters.read_hist[hist_bucket(sector_count)]++;
+    count_buffer(dst, sector_count);
+    spend(card_cfg.cmd_us + (uint64_t) card_cfg.read_us * sector_count);
+
+    size_t ss = card->csd.sector_size;
+    if (card_ram) {
+        memcpy(dst, &card_ram[start_sector * ss], sector_count * ss);
+    } else if (pread(card_fd, dst, sector_count * ss,
+                (off_t) (start_sector * ss)) < 0) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t sdmmc_write_sectors(sdmmc_card_t *card, const void *src,
+        size_t start_sector, size_t sector_count)
+{
+    esp_err_t e = check_range(card, start_sector, sector_count);
+    if (e != ESP_OK || sector_count == 0) {
+        return e;
+    }
+    mock_counters.writes++;
+    mock_counters.write_sectors += sector_count;
+    mock_counters.write_hist[hist_bucket(sector_count)]++;
+    count_buffer(src, sector_count);
+
+    size_t ss = card->csd.sector_size;
+    uint64_t page = card_cfg.page_size ? card_cfg.page_size : ss;
+    uint64_t first = (uint64_t) start_sector * ss / page;
+    uint64_t last = ((uint64_t) (start_sector + sector_count) * ss - 1) / page;
+    spend(card_cfg.cmd_us + card_cfg.page_us * (last - first + 1));
+    if (card_ram) {
+        memcpy(&card_ram[start_sector * ss], src, sector_count * ss);
+    } else if (pwrite(card_fd, src, sector_count * ss,
+                (off_t) (start_sector * ss)) < 0) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* instrumentation */
+const struct mock_stats *mock_stats(void)
+{
+    return &mock_counters;
+}
+
+void mock_stats_reset(void)
+{
+    memset(&mock_counters, 0, sizeof(mock_counters));
+}
+
+static void print_hist(const char *name, const uint32_t *hist)
+{
+    printf("  %s sizes:", name);
+    for (unsigned i = 0; i < MOCK_HIST_BUCKETS; ++i) {
+        if (hist[i]) {
+            printf(" %u:%u", 1u << i, (unsigned) hist[i]);
+        }
+    }
+    printf("\n");
+}
+
+void mock_stats_print(const char *title)
+{
+    const struct mock_stats *s = &mock_counters;
+    printf("%s\n", title);
+    printf("  reads %u (%llu sectors), writes %u (%llu sectors)\n",
+            (unsigned) s->reads, (unsigned long long) s->read_sectors,
+            (unsigned) s->writes, (unsigned long long) s->write_sectors);
+    print_hist("read", s->read_hist);
+    print_hist("write", s->write_hist);
+    printf("  unaligned %u, bounced %u (%llu sectors)\n",
+            (unsigned) s->unaligned, (unsigned) s->bounced,
+            (unsigned long long) s->bounced_sectors);
+    printf("  busy %llu us\n", (unsigned long long) s->busy_us);
+    printf("  dma allocs %u, frees %u, %llu bytes\n",
+            (unsigned) s->dma_allocs, (unsigned) s->dma_frees,
+            (unsigned long long) s->dma_bytes);
+}
@@ -0,0 +1,204 @@
+/*
+ * Host stand-ins for esp-idf's heap_caps, newlib locks, logging and the
+ * ROM crc routines
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp32/rom/crc.h"
+#include "sys/lock.h"
+#include "mock.h"
+
+/* logging */
+static esp_log_level_t log_level = ESP_LOG_WARN;
+static const char level_char[] = "NEWIDV";
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    (void) tag;
+    log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag,
+        const char *format, ...)
+{
+    if (level > log_level) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%c (%s) ", level_char[level], tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+/* heap_caps, DMA-capable allocations are remembered so the sdmmc mock can
+ * tell which buffers the real driver could DMA into */
+#define MAX_DMA_ALLOCS 64
+
+static struct {
+    const uint8_t *ptr;
+    size_t size;
+} dma_allocs[MAX_DMA_ALLOCS];
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    void *p = malloc(size);
+    if (!p || !(caps & MALLOC_CAP_DMA)) {
+        return p;
+    }
+    pthread_mutex_lock(&heap_lock);
+    for (int i = 0; i < MAX_DMA_ALLOCS; ++i) {
+        if (!dma_allocs[i].ptr) {
+            dma_allocs[i].ptr = p;
+            dma_allocs[i].size = size;
+            break;
+        }
+    }
+    mock_counters.dma_allocs += 1;
+    mock_counters.dma_bytes += size;
+    pthread_mutex_unlock(&heap_lock);
+    return p;
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    void *p = heap_caps_malloc(n * size, caps);
+    if (p) {
+        memset(p, 0, n * size);
+    }
+    return p;
+}
+
+void heap_caps_free(void *ptr)
+{
+    pthread_mutex_lock(&heap_lock);
+    for (int i = 0; i < MAX_DMA_ALLOCS; ++i) {
+        if (ptr && dma_allocs[i].ptr == ptr) {
+            dma_allocs[i].ptr = NULL;
+            mock_counters.dma_frees += 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+    free(ptr);
+}
+
+bool mock_heap_dma_capable(const void *ptr)
+{
+    const uint8_t *p = ptr;
+    bool found = false;
+    pthread_mutex_lock(&heap_lock);
+    for (int i = 0; i < MAX_DMA_ALLOCS; ++i) {
+        if (dma_allocs[i].ptr && p >= dma_allocs[i].ptr
+                && p < dma_allocs[i].ptr + dma_allocs[i].size) {
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return found;
+}
+
+/* newlib locks, all locks are recursive and zeroed locks are lazily
+ * initialized like in esp-idf */
+struct mock_lock {
+    pthread_mutex_t mutex;
+};
+
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void _lock_init(_lock_t *lock)
+{
+    struct mock_lock *l = malloc(sizeof(*l));
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&l->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    *lock = l;
+}
+
+void _lock_init_recursive(_lock_t *lock)
+{
+    _lock_init(lock);
+}
+
+void _lock_close(_lock_t *lock)
+{
+    if (*lock) {
+        pthread_mutex_destroy(&(*lock)->mutex);
+        free(*lock);
+        *lock = NULL;
+    }
+}
+
+void _lock_close_recursive(_lock_t *lock)
+{
+    _lock_close(lock);
+}
+
+static struct mock_lock *lock_get(_lock_t *lock)
+{
+    pthread_mutex_lock(&init_lock);
+    if (!*lock) {
+        _lock_init(lock);
+    }
+    pthread_mutex_unlock(&init_lock);
+    return *lock;
+}
+
+void _lock_acquire(_lock_t *lock)
+{
+    pthread_mutex_lock(&lock_get(lock)->mutex);
+}
+
+void _lock_acquire_recursive(_lock_t *lock)
+{
+    _lock_acquire(lock);
+}
+
+int _lock_try_acquire(_lock_t *lock)
+{
+    return pthread_mutex_trylock(&lock_get(lock)->mutex);
+}
+
+int _lock_try_acquire_recursive(_lock_t *lock)
+{
+    return _lock_try_acquire(lock);
+}
+
+void _lock_release(_lock_t *lock)
+{
+    pthread_mutex_unlock(&(*lock)->mutex);
+}
+
+void _lock_release_recursive(_lock_t *lock)
+{
+    _lock_release(lock);
+}
+
+/* ROM crc32, reflected polynomial 0x04c11db7 with inverted initial and
+ * final values */
+uint32_t crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    static const uint32_t rtable[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; ++i) {
+        crc = (crc >> 4) ^ rtable[(crc ^ (buf[i] >> 0)) & 0xf];
+        crc = (crc >> 4) ^ rtable[(crc ^ (buf[i] >> 4)) & 0xf];
+    }
+    return ~crc;
+}
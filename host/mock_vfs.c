@@ -0,0 +1,272 @@
+/*
+ * Host stand-in for the esp-idf VFS. Drivers registered with
+ * esp_vfs_register are called through the mock_vfs_* functions, which
+ * strip the base path and route file descriptors like the real VFS.
+ */
+#include <errno.h>
+#include <string.h>
+#include "esp_vfs.h"
+#include "mock.h"
+
+#define MAX_VFS 4
+#define MAX_FDS 256
+
+typedef struct {
+    char base_path[ESP_VFS_PATH_MAX + 1];
+    size_t base_len;
+    esp_vfs_t vfs;
+    void *ctx;
+    bool used;
+} vfs_entry_t;
+
+static vfs_entry_t vfs_table[MAX_VFS];
+static signed char fd_owner[MAX_FDS]; /* vfs index + 1, 0 if unused */
+
+esp_err_t esp_vfs_register(const char *base_path, const esp_vfs_t *vfs,
+        void *ctx)
+{
+    size_t len = strlen(base_path);
+    if (len > ESP_VFS_PATH_MAX || (len > 0 && base_path[0] != '/')) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (vfs->flags != ESP_VFS_FLAG_CONTEXT_PTR) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    for (int i = 0; i < MAX_VFS; ++i) {
+        if (!vfs_table[i].used) {
+            vfs_entry_t *e = &vfs_table[i];
+            strcpy(e->base_path, base_path);
+            e->base_len = len;
+            e->vfs = *vfs;
+            e->ctx = ctx;
+            e->used = true;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_vfs_unregister(const char *base_path)
+{
+    for (int i = 0; i < MAX_VFS; ++i) {
+        if (vfs_table[i].used && !strcmp(vfs_table[i].base_path, base_path)) {
+            vfs_table[i].used = false;
+            for (int fd = 0; fd < MAX_FDS; ++fd) {
+                if (fd_owner[fd] == i + 1) {
+                    fd_owner[fd] = 0;
+                }
+            }
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_STATE;
+}
+
+/* find the driver for a path, *subpath is the path within the mount */
+static vfs_entry_t *vfs_for_path(const char *path, const char **subpath)
+{
+    vfs_entry_t *best = NULL;
+    for (int i = 0; i < MAX_VFS; ++i) {
+        vfs_entry_t *e = &vfs_table[i];
+        if (e->used && !strncmp(path, e->base_path, e->base_len)
+                && (path[e->base_len] == '/' || path[e->base_len] == '\0')
+                && (!best || e->base_len > best->base_len)) {
+            best = e;
+        }
+    }
+    if (!best) {
+        errno = ENOENT;
+        return NULL;
+    }
+    *subpath = path + best->base_len;
+    return best;
+}
+
+static vfs_entry_t *vfs_for_fd(int fd)
+{
+    if (fd < 0 || fd >= MAX_FDS || !fd_owner[fd]) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &vfs_table[fd_owner[fd] - 1];
+}
+
+#define CHECK(e, op) do { \
+        if (!(e)->vfs.op) { errno = ENOSYS; return -1; } \
+    } while (0)
+
+int mock_vfs_open(const char *path, int flags, int mode)
+{
+    const char *sub;
+    vfs_entry_t *e = vfs_for_path(path, &sub);
+    if (!e) { return -1; }
+    CHECK(e, open_p);
+    int fd = e->vfs.open_p(e->ctx, sub, flags, mode);
+    if (fd < 0) {
+        return fd;
+    }
+    if (fd >= MAX_FDS || fd_owner[fd]) {
+        e->vfs.close_p(e->ctx, fd);
+        errno = EMFILE;
+        return -1;
+    }
+    fd_owner[fd] = (signed char) (e - vfs_table) + 1;
+    return fd;
+}
+
+ssize_t mock_vfs_read(int fd, void *dst, size_t size)
+{
+    vfs_entry_t *e = vfs_for_fd(fd);
+    if (!e) { return -1; }
+    CHECK(e, read_p);
+    return e->vfs.read_p(e->ctx, fd, dst, size);
+}
+
+ssize_t mock_vfs_write(int fd, const void *src, size_t size)
+{
+    vfs_entry_t *e = vfs_for_fd(fd);
+    if (!e) { return -1; }
+    CHECK(e, write_p);
+    return e->vfs.write_p(e->ctx, fd, src, size);
+}
+
+off_t mock_vfs_lseek(int fd, off_t offset, int mode)
+{
+    vfs_entry_t *e = vfs_for_fd(fd);
+    if (!e) { return -1; }
+    CHECK(e, lseek_p);
+    return e->vfs.lseek_p(e->ctx, fd, offset, mode);
+}
+
+int mock_vfs_fsync(int fd)
+{
+    vfs_entry_t *e = vfs_for_fd(fd);
+    if (!e) { return -1; }
+    CHECK(e, fsync_p);
+    return e->vfs.fsync_p(e->ctx, fd);
+}
+
+int mock_vfs_fstat(int fd, struct stat *st)
+{
+    vfs_entry_t *e = vfs_for_fd(fd);
+    if (!e) { return -1; }
+    CHECK(e, fstat_p);
+    return e->vfs.fstat_p(e->ctx, fd, st);
+}
+
+int mock_vfs_close(int fd)
+{
+    vfs_entry_t *e = vfs_for_fd(fd);
+    if (!e) { return -1; }
+    CHECK(e, close_p);
+    int ret = e->vfs.close_p(e->ctx, fd);
+    fd_owner[fd] = 0;
+    return ret;
+}
+
+int mock_vfs_stat(const char *path, struct stat *st)
+{
+    const char *sub;
+    vfs_entry_t *e = vfs_for_path(path, &sub);
+    if (!e) { return -1; }
+    CHECK(e, stat_p);
+    return e->vfs.stat_p(e->ctx, sub, st);
+}
+
+int mock_vfs_unlink(const char *path)
+{
+    const char *sub;
+    vfs_entry_t *e = vfs_for_path(path, &sub);
+    if (!e) { return -1; }
+    CHECK(e, unlink_p);
+    return e->vfs.unlink_p(e->ctx, sub);
+}
+
+int mock_vfs_rename(const char *src, const char *dst)
+{
+    const char *sub_src, *sub_dst;
+    vfs_entry_t *e = vfs_for_path(src, &sub_src);
+    if (!e) { return -1; }
+    if (vfs_for_path(dst, &sub_dst) != e) {
+        errno = EXDEV;
+        return -1;
+    }
+    CHECK(e, rename_p);
+    return e->vfs.rename_p(e->ctx, sub_src, sub_dst);
+}
+
+int mock_vfs_mkdir(const char *path, mode_t mode)
+{
+    const char *sub;
+    vfs_entry_t *e = vfs_for_path(path, &sub);
+    if (!e) { return -1; }
+    CHECK(e, mkdir_p);
+    return e->vfs.mkdir_p(e->ctx, sub, mode);
+}
+
+int mock_vfs_rmdir(const char *path)
+{
+    const char *sub;
+    vfs_entry_t *e = vfs_for_path(path, &sub);
+    if (!e) { return -1; }
+    CHECK(e, rmdir_p);
+    return e->vfs.rmdir_p(e->ctx, sub);
+}
+
+int mock_vfs_truncate(const char *path, off_t length)
+{
+    const char *sub;
+    vfs_entry_t *e = vfs_for_path(path, &sub);
+    if (!e) { return -1; }
+    CHECK(e, truncate_p);
+    return e->vfs.truncate_p(e->ctx, sub, length);
+}
+
+DIR *mock_vfs_opendir(const char *path)
+{
+    const char *sub;
+    vfs_entry_t *e = vfs_for_path(path, &sub);
+    if (!e) { return NULL; }
+    if (!e->vfs.opendir_p) { errno = ENOSYS; return NULL; }
+    DIR *dir = e->vfs.opendir_p(e->ctx, sub);
+    if (dir) {
+        dir->dd_vfs_idx = (uint16_t) (e - vfs_table);
+    }
+    return dir;
+}
+
+struct dirent *mock_vfs_readdir(DIR *dir)
+{
+    vfs_entry_t *e = &vfs_table[dir->dd_vfs_idx];
+    if (!e->vfs.readdir_p) { errno = ENOSYS; return NULL; }
+    return e->vfs.readdir_p(e->ctx, dir);
+}
+
+int mock_vfs_readdir_r(DIR *dir, struct dirent *entry, struct dirent **out)
+{
+    vfs_entry_t *e = &vfs_table[dir->dd_vfs_idx];
+    if (!e->vfs.readdir_r_p) { return ENOSYS; }
+    return e->vfs.readdir_r_p(e->ctx, dir, entry, out);
+}
+
+long mock_vfs_telldir(DIR *dir)
+{
+    vfs_entry_t *e = &vfs_table[dir->dd_vfs_idx];
+    CHECK(e, telldir_p);
+    return e->vfs.telldir_p(e->ctx, dir);
+}
+
+void mock_vfs_seekdir(DIR *dir, long offset)
+{
+    vfs_entry_t *e = &vfs_table[dir->dd_vfs_idx];
+    if (e->vfs.seekdir_p) {
+        e->vfs.seekdir_p(e->ctx, dir, offset);
+    }
+}
+
+int mock_vfs_closedir(DIR *dir)
+{
+    vfs_entry_t *e = &vfs_table[dir->dd_vfs_idx];
+    CHECK(e, closedir_p);
+    return e->vfs.closedir_p(e->ctx, dir);
+}
@@ -4,11 +4,147 @@
  * Copyright (c) 2017, Arm Limited. All rights reserved.
  * SPDX-License-Identifier: BSD-3-Clause
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "bd/lfs_filebd.h"
 
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdlib.h>
+
+
+/// Internal file access ///
+
+// These access the file with pread/pwrite. In direct mode, accesses are
+// aligned to LFS_FILEBD_DIRECT_ALIGN, going through the direct buffer if
+// the caller's buffer or range is unaligned.
+static lfs_size_t lfs_filebd_directsize(const struct lfs_config *cfg) {
+    return lfs_alignup(cfg->block_size, LFS_FILEBD_DIRECT_ALIGN);
+}
+
+static bool lfs_filebd_isaligned(off_t pos, const void *buffer,
+        lfs_size_t size) {
+    return pos % LFS_FILEBD_DIRECT_ALIGN == 0
+            && size % LFS_FILEBD_DIRECT_ALIGN == 0
+            && (uintptr_t)buffer % LFS_FILEBD_DIRECT_ALIGN == 0;
+}
+
+static int lfs_filebd_rawread(const struct lfs_config *cfg, off_t pos,
+        void *buffer, lfs_size_t size) {
+    lfs_filebd_t *bd = cfg->context;
+    uint8_t *data = buffer;
+    if (!bd->cfg->direct || lfs_filebd_isaligned(pos, data, size)) {
+        ssize_t res = pread(bd->fd, data, size, pos);
+        if (res < 0) {
+            return -errno;
+        }
+
+        return 0;
+    }
+
+    while (size > 0) {
+        off_t apos = pos - pos % LFS_FILEBD_DIRECT_ALIGN;
+        lfs_size_t aoff = (lfs_size_t)(pos - apos);
+        lfs_size_t diff = lfs_min(size, lfs_filebd_directsize(cfg) - aoff);
+        ssize_t res = pread(bd->fd, bd->direct_buffer,
+                lfs_alignup(aoff + diff, LFS_FILEBD_DIRECT_ALIGN), apos);
+        if (res < 0) {
+            return -errno;
+        }
+
+        // anything past the end of the file is left as is
+        if ((lfs_size_t)res > aoff) {
+            memcpy(data, &bd->direct_buffer[aoff],
+                    lfs_min(diff, (lfs_size_t)res - aoff));
+        }
+
+        pos += diff;
+        data += diff;
+        size -= diff;
+    }
+
+    return 0;
+}
+
+static int lfs_filebd_rawwrite(const struct lfs_config *cfg, off_t pos,
+        const void *buffer, lfs_size_t size) {
+    lfs_filebd_t *bd = cfg->context;
+    const uint8_t *data = buffer;
+    if (!bd->cfg->direct || lfs_filebd_isaligned(pos, data, size)) {
+        ssize_t res = pwrite(bd->fd, data, size, pos);
+        if (res < 0) {
+            return -errno;
+        }
+
+        return 0;
+    }
+
+    while (size > 0) {
+        off_t apos = pos - pos % LFS_FILEBD_DIRECT_ALIGN;
+        lfs_size_t aoff = (lfs_size_t)(pos - apos);
+        lfs_size_t diff = lfs_min(size, lfs_filebd_directsize(cfg) - aoff);
+        lfs_size_t asize = lfs_alignup(aoff + diff, LFS_FILEBD_DIRECT_ALIGN);
+
+        // unaligned? read-modify-write the surrounding data
+        if (aoff != 0 || diff != asize) {
+            memset(bd->direct_buffer,
+                    (bd->cfg->erase_value != -1) ? bd->cfg->erase_value : 0,
+                    asize);
+            ssize_t res = pread(bd->fd, bd->direct_buffer, asize, apos);
+            if (res < 0) {
+                return -errno;
+            }
+        }
+
+        memcpy(&bd->direct_buffer[aoff], data, diff);
+        ssize_t res = pwrite(bd->fd, bd->direct_buffer, asize, apos);
+        if (res < 0) {
+            return -errno;
+        }
+
+        pos += diff;
+        data += diff;
+        size -= diff;
+    }
+
+    return 0;
+}
+
+// Write out any buffered progs
+static int lfs_filebd_flush(const struct lfs_config *cfg) {
+    lfs_filebd_t *bd = cfg->context;
+    if (bd->prog_size > 0) {
+        int err = lfs_filebd_rawwrite(cfg,
+                (off_t)bd->prog_block*cfg->block_size + (off_t)bd->prog_off,
+                bd->prog_buffer, bd->prog_size);
+        if (err) {
+            return err;
+        }
+
+        bd->prog_size = 0;
+    }
+
+    return 0;
+}
+
+// Write out buffered progs if they overlap a range of the file
+static int lfs_filebd_flushrange(const struct lfs_config *cfg, off_t pos,
+        lfs_size_t size) {
+    lfs_filebd_t *bd = cfg->context;
+    off_t ppos = (off_t)bd->prog_block*cfg->block_size + (off_t)bd->prog_off;
+    if (bd->prog_size > 0
+            && pos < ppos + (off_t)bd->prog_size
+            && ppos < pos + (off_t)size) {
+        return lfs_filebd_flush(cfg);
+    }
+
+    return 0;
+}
+
+
+/// Block device API ///
 
 int lfs_filebd_createcfg(const struct lfs_config *cfg, const char *path,
         const struct lfs_filebd_config *bdcfg) {
@@ -17,23 +153,65 @@ int lfs_filebd_createcfg(const struct lfs_config *cfg, const char *path,
                 ".read_size=%"PRIu32", .prog_size=%"PRIu32", "
                 ".block_size=%"PRIu32", .block_count=%"PRIu32"}, "
                 "\"%s\", "
-                "%p {.erase_value=%"PRId32"})",
+                "%p {.erase_value=%"PRId32", .direct=%d, "
+                ".prog_buffer_size=%"PRIu32", .prog_buffer=%p})",
             (void*)cfg, cfg->context,
             (void*)(uintptr_t)cfg->read, (void*)(uintptr_t)cfg->prog,
             (void*)(uintptr_t)cfg->erase, (void*)(uintptr_t)cfg->sync,
             cfg->read_size, cfg->prog_size, cfg->block_size, cfg->block_count,
-            path, (void*)bdcfg, bdcfg->erase_value);
+            path, (void*)bdcfg, bdcfg->erase_value, bdcfg->direct,
+            bdcfg->prog_buffer_size, bdcfg->prog_buffer);
     lfs_filebd_t *bd = cfg->context;
     bd->cfg = bdcfg;
+    bd->direct_buffer = NULL;
+    bd->prog_buffer = NULL;
+    bd->prog_block = 0;
+    bd->prog_off = 0;
+    bd->prog_size = 0;
 
     // open file
-    bd->fd = open(path, O_RDWR | O_CREAT, 0666);
+    int flags = O_RDWR | O_CREAT;
+    if (bd->cfg->direct) {
+#ifdef O_DIRECT
+        flags |= O_DIRECT;
+#else
+        LFS_FILEBD_TRACE("lfs_filebd_createcfg -> %d", LFS_ERR_INVAL);
+        return LFS_ERR_INVAL;
+#endif
+    }
+
+    bd->fd = open(path, flags, 0666);
     if (bd->fd < 0) {
         int err = -errno;
         LFS_FILEBD_TRACE("lfs_filebd_createcfg -> %d", err);
         return err;
     }
 
+    // allocate aligned buffer for direct mode?
+    if (bd->cfg->direct) {
+        void *buffer;
+        if (posix_memalign(&buffer, LFS_FILEBD_DIRECT_ALIGN,
+                lfs_filebd_directsize(cfg))) {
+            close(bd->fd);
+            LFS_FILEBD_TRACE("lfs_filebd_createcfg -> %d", LFS_ERR_NOMEM);
+            return LFS_ERR_NOMEM;
+        }
+        bd->direct_buffer = buffer;
+    }
+
+    // allocate prog buffer?
+    if (bd->cfg->prog_buffer) {
+        bd->prog_buffer = bd->cfg->prog_buffer;
+    } else if (bd->cfg->prog_buffer_size) {
+        bd->prog_buffer = lfs_malloc(bd->cfg->prog_buffer_size);
+        if (!bd->prog_buffer) {
+            free(bd->direct_buffer);
+            close(bd->fd);
+            LFS_FILEBD_TRACE("lfs_filebd_createcfg -> %d", LFS_ERR_NOMEM);
+            return LFS_ERR_NOMEM;
+        }
+    }
+
     LFS_FILEBD_TRACE("lfs_filebd_createcfg -> %d", 0);
     return 0;
 }
@@ -58,14 +236,21 @@ int lfs_filebd_create(const struct lfs_config *cfg, const char *path) {
 int lfs_filebd_destroy(const struct lfs_config *cfg) {
     LFS_FILEBD_TRACE("lfs_filebd_destroy(%p)", (void*)cfg);
     lfs_filebd_t *bd = cfg->context;
-    int err = close(bd->fd);
-    if (err < 0) {
+
+    // write out any buffered progs, but clean up even if this fails
+    int err = lfs_filebd_flush(cfg);
+
+    if (!bd->cfg->prog_buffer) {
+        lfs_free(bd->prog_buffer);
+    }
+    free(bd->direct_buffer);
+
+    if (close(bd->fd) < 0 && !err) {
         err = -errno;
-        LFS_FILEBD_TRACE("lfs_filebd_destroy -> %d", err);
-        return err;
     }
-    LFS_FILEBD_TRACE("lfs_filebd_destroy -> %d", 0);
-    return 0;
+
+    LFS_FILEBD_TRACE("lfs_filebd_destroy -> %d", err);
+    return err;
 }
 
 int lfs_filebd_read(const struct lfs_config *cfg, lfs_block_t block,
@@ -85,18 +270,16 @@ int lfs_filebd_read(const struct lfs_config *cfg, lfs_block_t block,
         memset(buffer, bd->cfg->erase_value, size);
     }
 
-    // read
-    off_t res1 = lseek(bd->fd,
-            (off_t)block*cfg->block_size + (off_t)off, SEEK_SET);
-    if (res1 < 0) {
-        int err = -errno;
+    // read, making sure we see any buffered progs
+    off_t pos = (off_t)block*cfg->block_size + (off_t)off;
+    int err = lfs_filebd_flushrange(cfg, pos, size);
+    if (err) {
         LFS_FILEBD_TRACE("lfs_filebd_read -> %d", err);
         return err;
     }
 
-    ssize_t res2 = read(bd->fd, buffer, size);
-    if (res2 < 0) {
-        int err = -errno;
+    err = lfs_filebd_rawread(cfg, pos, buffer, size);
+    if (err) {
         LFS_FILEBD_TRACE("lfs_filebd_read -> %d", err);
         return err;
     }
@@ -116,41 +299,61 @@ int lfs_filebd_prog(const struct lfs_config *cfg, lfs_block_t block,
     LFS_ASSERT(size % cfg->prog_size == 0);
     LFS_ASSERT(block < cfg->block_count);
 
+    off_t pos = (off_t)block*cfg->block_size + (off_t)off;
+
     // check that data was erased? only needed for testing
     if (bd->cfg->erase_value != -1) {
-        off_t res1 = lseek(bd->fd,
-                (off_t)block*cfg->block_size + (off_t)off, SEEK_SET);
-        if (res1 < 0) {
-            int err = -errno;
+        int err = lfs_filebd_flushrange(cfg, pos, size);
+        if (err) {
             LFS_FILEBD_TRACE("lfs_filebd_prog -> %d", err);
             return err;
         }
 
-        for (lfs_off_t i = 0; i < size; i++) {
-            uint8_t c;
-            ssize_t res2 = read(bd->fd, &c, 1);
-            if (res2 < 0) {
-                int err = -errno;
+        for (lfs_off_t i = 0; i < size; i += 64) {
+            uint8_t c[64];
+            lfs_size_t diff = lfs_min(size - i, sizeof(c));
+            memset(c, bd->cfg->erase_value, diff);
+            err = lfs_filebd_rawread(cfg, pos + (off_t)i, c, diff);
+            if (err) {
                 LFS_FILEBD_TRACE("lfs_filebd_prog -> %d", err);
                 return err;
             }
 
-            LFS_ASSERT(c == bd->cfg->erase_value);
+            for (lfs_off_t j = 0; j < diff; j++) {
+                LFS_ASSERT(c[j] == bd->cfg->erase_value);
+            }
         }
     }
 
-    // program data
-    off_t res1 = lseek(bd->fd,
-            (off_t)block*cfg->block_size + (off_t)off, SEEK_SET);
-    if (res1 < 0) {
-        int err = -errno;
-        LFS_FILEBD_TRACE("lfs_filebd_prog -> %d", err);
-        return err;
+    // buffer prog? this only works if it continues the buffered progs
+    if (bd->cfg->prog_buffer_size) {
+        off_t ppos = (off_t)bd->prog_block*cfg->block_size
+                + (off_t)bd->prog_off;
+        if (bd->prog_size > 0 && (pos != ppos + (off_t)bd->prog_size
+                || bd->prog_size + size > bd->cfg->prog_buffer_size)) {
+            int err = lfs_filebd_flush(cfg);
+            if (err) {
+                LFS_FILEBD_TRACE("lfs_filebd_prog -> %d", err);
+                return err;
+            }
+        }
+
+        if (size <= bd->cfg->prog_buffer_size) {
+            if (bd->prog_size == 0) {
+                bd->prog_block = block;
+                bd->prog_off = off;
+            }
+
+            memcpy(&bd->prog_buffer[bd->prog_size], buffer, size);
+            bd->prog_size += size;
+            LFS_FILEBD_TRACE("lfs_filebd_prog -> %d", 0);
+            return 0;
+        }
     }
 
-    ssize_t res2 = write(bd->fd, buffer, size);
-    if (res2 < 0) {
-        int err = -errno;
+    // program data
+    int err = lfs_filebd_rawwrite(cfg, pos, buffer, size);
+    if (err) {
         LFS_FILEBD_TRACE("lfs_filebd_prog -> %d", err);
         return err;
     }
@@ -166,19 +369,22 @@ int lfs_filebd_erase(const struct lfs_config *cfg, lfs_block_t block) {
     // check if erase is valid
     LFS_ASSERT(block < cfg->block_count);
 
+    // buffered progs must not land after the erase
+    off_t pos = (off_t)block*cfg->block_size;
+    int err = lfs_filebd_flushrange(cfg, pos, cfg->block_size);
+    if (err) {
+        LFS_FILEBD_TRACE("lfs_filebd_erase -> %d", err);
+        return err;
+    }
+
     // erase, only needed for testing
     if (bd->cfg->erase_value != -1) {
-        off_t res1 = lseek(bd->fd, (off_t)block*cfg->block_size, SEEK_SET);
-        if (res1 < 0) {
-            int err = -errno;
-            LFS_FILEBD_TRACE("lfs_filebd_erase -> %d", err);
-            return err;
-        }
-
-        for (lfs_off_t i = 0; i < cfg->block_size; i++) {
-            ssize_t res2 = write(bd->fd, &(uint8_t){bd->cfg->erase_value}, 1);
-            if (res2 < 0) {
-                int err = -errno;
+        uint8_t c[LFS_FILEBD_DIRECT_ALIGN];
+        memset(c, bd->cfg->erase_value, sizeof(c));
+        for (lfs_off_t i = 0; i < cfg->block_size; i += sizeof(c)) {
+            err = lfs_filebd_rawwrite(cfg, pos + (off_t)i, c,
+                    lfs_min(cfg->block_size - i, sizeof(c)));
+            if (err) {
                 LFS_FILEBD_TRACE("lfs_filebd_erase -> %d", err);
                 return err;
             }
@@ -191,12 +397,19 @@ int lfs_filebd_erase(const struct lfs_config *cfg, lfs_block_t block) {
 
 int lfs_filebd_sync(const struct lfs_config *cfg) {
     LFS_FILEBD_TRACE("lfs_filebd_sync(%p)", (void*)cfg);
+    // write out buffered progs
+    int err = lfs_filebd_flush(cfg);
+    if (err) {
+        LFS_FILEBD_TRACE("lfs_filebd_sync -> %d", err);
+        return err;
+    }
+
     // file sync
     lfs_filebd_t *bd = cfg->context;
-    int err = fsync(bd->fd);
+    err = fsync(bd->fd);
     if (err) {
         err = -errno;
-        LFS_FILEBD_TRACE("lfs_filebd_sync -> %d", 0);
+        LFS_FILEBD_TRACE("lfs_filebd_sync -> %d", err);
         return err;
     }
 
@@ -16,6 +16,12 @@ extern "C"
 #endif
 
 
+// Alignment of file accesses when using O_DIRECT, this needs to be a
+// multiple of the host disk's logical sector size
+#ifndef LFS_FILEBD_DIRECT_ALIGN
+#define LFS_FILEBD_DIRECT_ALIGN 4096
+#endif
+
 // Block device specific tracing
 #ifdef LFS_FILEBD_YES_TRACE
 #define LFS_FILEBD_TRACE(...) LFS_TRACE(__VA_ARGS__)
@@ -29,16 +35,39 @@ struct lfs_filebd_config {
     // erases, which can speed up testing by avoiding all the extra block-device
     // operations to store the erase value.
     int32_t erase_value;
+
+    // If true, open the file with O_DIRECT, bypassing the OS's page cache.
+    // File accesses are then aligned to LFS_FILEBD_DIRECT_ALIGN, unaligned
+    // reads and progs go through an aligned buffer, as they would on a disk
+    // with a large sector size.
+    bool direct;
+
+    // Size of an optional buffer used to coalesce adjacent progs into one
+    // write. Buffered progs are written out on sync, or earlier if a later
+    // operation needs them. Zero writes each prog as it happens.
+    lfs_size_t prog_buffer_size;
+
+    // Optional statically allocated prog buffer. Must be prog_buffer_size.
+    // By default lfs_malloc is used to allocate this buffer.
+    void *prog_buffer;
 };
 
 // filebd state
 typedef struct lfs_filebd {
     int fd;
+    uint8_t *direct_buffer;
+    uint8_t *prog_buffer;
+    lfs_block_t prog_block;
+    lfs_off_t prog_off;
+    lfs_size_t prog_size;
     const struct lfs_filebd_config *cfg;
 } lfs_filebd_t;
 
 
 // Create a file block device using the geometry in lfs_config
+//
+// Note that a filebd is not safe to share between threads if prog
+// buffering or direct mode are enabled.
 int lfs_filebd_create(const struct lfs_config *cfg, const char *path);
 int lfs_filebd_createcfg(const struct lfs_config *cfg, const char *path,
         const struct lfs_filebd_config *bdcfg);
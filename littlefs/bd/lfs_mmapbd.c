@@ -0,0 +1,224 @@
+/*
+ * Block device emulated in a memory-mapped file
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "bd/lfs_mmapbd.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int lfs_mmapbd_createcfg(const struct lfs_config *cfg, const char *path,
+        const struct lfs_mmapbd_config *bdcfg) {
+    LFS_MMAPBD_TRACE("lfs_mmapbd_createcfg(%p {.context=%p, "
+                ".read=%p, .prog=%p, .erase=%p, .sync=%p, "
+                ".read_size=%"PRIu32", .prog_size=%"PRIu32", "
+                ".block_size=%"PRIu32", .block_count=%"PRIu32"}, "
+                "\"%s\", "
+                "%p {.erase_value=%"PRId32", .msync=%d, .sequential=%d, "
+                ".readonly=%d})",
+            (void*)cfg, cfg->context,
+            (void*)(uintptr_t)cfg->read, (void*)(uintptr_t)cfg->prog,
+            (void*)(uintptr_t)cfg->erase, (void*)(uintptr_t)cfg->sync,
+            cfg->read_size, cfg->prog_size, cfg->block_size, cfg->block_count,
+            path, (void*)bdcfg, bdcfg->erase_value,
+            bdcfg->msync, bdcfg->sequential, bdcfg->readonly);
+    lfs_mmapbd_t *bd = cfg->context;
+    bd->cfg = bdcfg;
+    size_t size = (size_t)cfg->block_size * cfg->block_count;
+
+    // open file
+    bd->fd = open(path, (bdcfg->readonly) ? O_RDONLY : O_RDWR | O_CREAT, 0666);
+    if (bd->fd < 0) {
+        int err = -errno;
+        LFS_MMAPBD_TRACE("lfs_mmapbd_createcfg -> %d", err);
+        return err;
+    }
+
+    // grow file if it is too small to map
+    struct stat st;
+    if (fstat(bd->fd, &st) < 0) {
+        int err = -errno;
+        close(bd->fd);
+        LFS_MMAPBD_TRACE("lfs_mmapbd_createcfg -> %d", err);
+        return err;
+    }
+
+    size_t oldsize = (size_t)st.st_size;
+    if (bdcfg->readonly && oldsize < size) {
+        close(bd->fd);
+        LFS_MMAPBD_TRACE("lfs_mmapbd_createcfg -> %d", LFS_ERR_INVAL);
+        return LFS_ERR_INVAL;
+    }
+
+    if (oldsize < size) {
+        off_t res1 = lseek(bd->fd, (off_t)size-1, SEEK_SET);
+        if (res1 < 0) {
+            int err = -errno;
+            close(bd->fd);
+            LFS_MMAPBD_TRACE("lfs_mmapbd_createcfg -> %d", err);
+            return err;
+        }
+
+        ssize_t res2 = write(bd->fd, &(uint8_t){0}, 1);
+        if (res2 < 0) {
+            int err = -errno;
+            close(bd->fd);
+            LFS_MMAPBD_TRACE("lfs_mmapbd_createcfg -> %d", err);
+            return err;
+        }
+    }
+
+    bd->buffer = mmap(NULL, size,
+            (bdcfg->readonly) ? PROT_READ : PROT_READ | PROT_WRITE,
+            MAP_SHARED, bd->fd, 0);
+    if (bd->buffer == MAP_FAILED) {
+        int err = -errno;
+        close(bd->fd);
+        LFS_MMAPBD_TRACE("lfs_mmapbd_createcfg -> %d", err);
+        return err;
+    }
+
+    // new space reads as erased, like reading past the end of a filebd
+    if (bd->cfg->erase_value != -1 && oldsize < size) {
+        memset(&bd->buffer[oldsize], bd->cfg->erase_value, size - oldsize);
+    }
+
+#ifdef POSIX_MADV_SEQUENTIAL
+    // this is only a hint, so errors are ignored
+    if (bd->cfg->sequential) {
+        posix_madvise(bd->buffer, size, POSIX_MADV_SEQUENTIAL);
+    }
+#endif
+
+    LFS_MMAPBD_TRACE("lfs_mmapbd_createcfg -> %d", 0);
+    return 0;
+}
+
+int lfs_mmapbd_create(const struct lfs_config *cfg, const char *path) {
+    LFS_MMAPBD_TRACE("lfs_mmapbd_create(%p {.context=%p, "
+                ".read=%p, .prog=%p, .erase=%p, .sync=%p, "
+                ".read_size=%"PRIu32", .prog_size=%"PRIu32", "
+                ".block_size=%"PRIu32", .block_count=%"PRIu32"}, "
+                "\"%s\")",
+            (void*)cfg, cfg->context,
+            (void*)(uintptr_t)cfg->read, (void*)(uintptr_t)cfg->prog,
+            (void*)(uintptr_t)cfg->erase, (void*)(uintptr_t)cfg->sync,
+            cfg->read_size, cfg->prog_size, cfg->block_size, cfg->block_count,
+            path);
+    static const struct lfs_mmapbd_config defaults = {.erase_value=-1};
+    int err = lfs_mmapbd_createcfg(cfg, path, &defaults);
+    LFS_MMAPBD_TRACE("lfs_mmapbd_create -> %d", err);
+    return err;
+}
+
+int lfs_mmapbd_destroy(const struct lfs_config *cfg) {
+    LFS_MMAPBD_TRACE("lfs_mmapbd_destroy(%p)", (void*)cfg);
+    lfs_mmapbd_t *bd = cfg->context;
+    int err = munmap(bd->buffer, (size_t)cfg->block_size * cfg->block_count);
+    if (err < 0) {
+        err = -errno;
+        close(bd->fd);
+        LFS_MMAPBD_TRACE("lfs_mmapbd_destroy -> %d", err);
+        return err;
+    }
+
+    err = close(bd->fd);
+    if (err < 0) {
+        err = -errno;
+        LFS_MMAPBD_TRACE("lfs_mmapbd_destroy -> %d", err);
+        return err;
+    }
+    LFS_MMAPBD_TRACE("lfs_mmapbd_destroy -> %d", 0);
+    return 0;
+}
+
+int lfs_mmapbd_read(const struct lfs_config *cfg, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    LFS_MMAPBD_TRACE("lfs_mmapbd_read(%p, "
+                "0x%"PRIx32", %"PRIu32", %p, %"PRIu32")",
+            (void*)cfg, block, off, buffer, size);
+    lfs_mmapbd_t *bd = cfg->context;
+
+    // check if read is valid
+    LFS_ASSERT(off  % cfg->read_size == 0);
+    LFS_ASSERT(size % cfg->read_size == 0);
+    LFS_ASSERT(block < cfg->block_count);
+
+    // read data
+    memcpy(buffer, &bd->buffer[(size_t)block*cfg->block_size + off], size);
+
+    LFS_MMAPBD_TRACE("lfs_mmapbd_read -> %d", 0);
+    return 0;
+}
+
+int lfs_mmapbd_prog(const struct lfs_config *cfg, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    LFS_MMAPBD_TRACE("lfs_mmapbd_prog(%p, "
+                "0x%"PRIx32", %"PRIu32", %p, %"PRIu32")",
+            (void*)cfg, block, off, buffer, size);
+    lfs_mmapbd_t *bd = cfg->context;
+
+    // check if write is valid
+    LFS_ASSERT(!bd->cfg->readonly);
+    LFS_ASSERT(off  % cfg->prog_size == 0);
+    LFS_ASSERT(size % cfg->prog_size == 0);
+    LFS_ASSERT(block < cfg->block_count);
+
+    // check that data was erased? only needed for testing
+    if (bd->cfg->erase_value != -1) {
+        for (lfs_off_t i = 0; i < size; i++) {
+            LFS_ASSERT(bd->buffer[(size_t)block*cfg->block_size + off + i] ==
+                    bd->cfg->erase_value);
+        }
+    }
+
+    // program data
+    memcpy(&bd->buffer[(size_t)block*cfg->block_size + off], buffer, size);
+
+    LFS_MMAPBD_TRACE("lfs_mmapbd_prog -> %d", 0);
+    return 0;
+}
+
+int lfs_mmapbd_erase(const struct lfs_config *cfg, lfs_block_t block) {
+    LFS_MMAPBD_TRACE("lfs_mmapbd_erase(%p, 0x%"PRIx32")", (void*)cfg, block);
+    lfs_mmapbd_t *bd = cfg->context;
+
+    // check if erase is valid
+    LFS_ASSERT(!bd->cfg->readonly);
+    LFS_ASSERT(block < cfg->block_count);
+
+    // erase, only needed for testing
+    if (bd->cfg->erase_value != -1) {
+        memset(&bd->buffer[(size_t)block*cfg->block_size],
+                bd->cfg->erase_value, cfg->block_size);
+    }
+
+    LFS_MMAPBD_TRACE("lfs_mmapbd_erase -> %d", 0);
+    return 0;
+}
+
+int lfs_mmapbd_sync(const struct lfs_config *cfg) {
+    LFS_MMAPBD_TRACE("lfs_mmapbd_sync(%p)", (void*)cfg);
+    lfs_mmapbd_t *bd = cfg->context;
+
+    // write back the mapping? not needed to survive the process exiting
+    if (bd->cfg->msync) {
+        int err = msync(bd->buffer,
+                (size_t)cfg->block_size * cfg->block_count, MS_SYNC);
+        if (err) {
+            err = -errno;
+            LFS_MMAPBD_TRACE("lfs_mmapbd_sync -> %d", err);
+            return err;
+        }
+    }
+
+    LFS_MMAPBD_TRACE("lfs_mmapbd_sync -> %d", 0);
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * Block device emulated in a memory-mapped file
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef LFS_MMAPBD_H
+#define LFS_MMAPBD_H
+
+#include "lfs.h"
+#include "lfs_util.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+// Block device specific tracing
+#ifdef LFS_MMAPBD_YES_TRACE
+#define LFS_MMAPBD_TRACE(...) LFS_TRACE(__VA_ARGS__)
+#else
+#define LFS_MMAPBD_TRACE(...)
+#endif
+
+// mmapbd config (optional)
+struct lfs_mmapbd_config {
+    // 8-bit erase value to use for simulating erases. -1 does not simulate
+    // erases, which can speed up testing by avoiding all the extra block-device
+    // operations to store the erase value.
+    int32_t erase_value;
+
+    // If true, sync writes the mapping back to the file with msync. Otherwise
+    // data reaches the file whenever the OS writes it back, which is still
+    // safe if the process exits, but not if the host loses power.
+    bool msync;
+
+    // If true, hint to the OS that the image will be accessed sequentially,
+    // for example when traversing or copying a whole image.
+    bool sequential;
+
+    // If true, the file is opened and mapped read-only, for tools that
+    // inspect an image. The file must already be large enough, and the
+    // block device must not be programmed or erased.
+    bool readonly;
+};
+
+// mmapbd state
+typedef struct lfs_mmapbd {
+    int fd;
+    uint8_t *buffer;
+    const struct lfs_mmapbd_config *cfg;
+} lfs_mmapbd_t;
+
+
+// Create a memory-mapped block device using the geometry in lfs_config
+//
+// The file is extended to fit the block device if it is too small, any new
+// space reads as erased.
+int lfs_mmapbd_create(const struct lfs_config *cfg, const char *path);
+int lfs_mmapbd_createcfg(const struct lfs_config *cfg, const char *path,
+        const struct lfs_mmapbd_config *bdcfg);
+
+// Clean up memory associated with block device
+int lfs_mmapbd_destroy(const struct lfs_config *cfg);
+
+// Read a block
+int lfs_mmapbd_read(const struct lfs_config *cfg, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size);
+
+// Program a block
+//
+// The block must have previously been erased.
+int lfs_mmapbd_prog(const struct lfs_config *cfg, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size);
+
+// Erase a block
+//
+// A block must be erased before being programmed. The
+// state of an erased block is undefined.
+int lfs_mmapbd_erase(const struct lfs_config *cfg, lfs_block_t block);
+
+// Sync the block device
+int lfs_mmapbd_sync(const struct lfs_config *cfg);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -1,6 +1,6 @@
 /*
- * Testing block device, wraps filebd and rambd while providing a bunch
- * of hooks for testing littlefs in various conditions.
+ * Testing block device, wraps mmapbd, filebd and rambd while providing a
+ * bunch of hooks for testing littlefs in various conditions.
  *
  * Copyright (c) 2017, Arm Limited. All rights reserved.
  * SPDX-License-Identifier: BSD-3-Clause
@@ -9,6 +9,13 @@
 
 #include <stdlib.h>
 
+// Operations seen by the timing model
+enum lfs_testbd_op {
+    LFS_TESTBD_OP_READ,
+    LFS_TESTBD_OP_PROG,
+    LFS_TESTBD_OP_ERASE,
+    LFS_TESTBD_OP_SYNC,
+};
 
 int lfs_testbd_createcfg(const struct lfs_config *cfg, const char *path,
         const struct lfs_testbd_config *bdcfg) {
@@ -19,20 +26,25 @@ int lfs_testbd_createcfg(const struct lfs_config *cfg, const char *path,
                 "\"%s\", "
                 "%p {.erase_value=%"PRId32", .erase_cycles=%"PRIu32", "
                 ".badblock_behavior=%"PRIu8", .power_cycles=%"PRIu32", "
-                ".buffer=%p, .wear_buffer=%p})",
+                ".buffer=%p, .wear_buffer=%p, .timing=%p, .filebd=%p})",
             (void*)cfg, cfg->context,
             (void*)(uintptr_t)cfg->read, (void*)(uintptr_t)cfg->prog,
             (void*)(uintptr_t)cfg->erase, (void*)(uintptr_t)cfg->sync,
             cfg->read_size, cfg->prog_size, cfg->block_size, cfg->block_count,
             path, (void*)bdcfg, bdcfg->erase_value, bdcfg->erase_cycles,
             bdcfg->badblock_behavior, bdcfg->power_cycles,
-            bdcfg->buffer, bdcfg->wear_buffer);
+            bdcfg->buffer, bdcfg->wear_buffer, (void*)bdcfg->timing,
+            (void*)bdcfg->filebd);
     lfs_testbd_t *bd = cfg->context;
     bd->cfg = bdcfg;
 
     // setup testing things
     bd->persist = path;
     bd->power_cycles = bd->cfg->power_cycles;
+    bd->time = 0;
+    bd->time_op = LFS_TESTBD_OP_SYNC;
+    bd->time_pos = 0;
+    bd->time_gc = 0;
 
     if (bd->cfg->erase_cycles) {
         if (bd->cfg->wear_buffer) {
@@ -49,11 +61,17 @@ int lfs_testbd_createcfg(const struct lfs_config *cfg, const char *path,
     }
 
     // create underlying block device
-    if (bd->persist) {
-        bd->u.file.cfg = (struct lfs_filebd_config){
+    if (bd->persist && bd->cfg->filebd) {
+        bd->u.file.cfg = *bd->cfg->filebd;
+        bd->u.file.cfg.erase_value = bd->cfg->erase_value;
+        int err = lfs_filebd_createcfg(cfg, path, &bd->u.file.cfg);
+        LFS_TESTBD_TRACE("lfs_testbd_createcfg -> %d", err);
+        return err;
+    } else if (bd->persist) {
+        bd->u.mmap.cfg = (struct lfs_mmapbd_config){
             .erase_value = bd->cfg->erase_value,
         };
-        int err = lfs_filebd_createcfg(cfg, path, &bd->u.file.cfg);
+        int err = lfs_mmapbd_createcfg(cfg, path, &bd->u.mmap.cfg);
         LFS_TESTBD_TRACE("lfs_testbd_createcfg -> %d", err);
         return err;
     } else {
@@ -91,10 +109,14 @@ int lfs_testbd_destroy(const struct lfs_config *cfg) {
         lfs_free(bd->wear);
     }
 
-    if (bd->persist) {
+    if (bd->persist && bd->cfg->filebd) {
         int err = lfs_filebd_destroy(cfg);
         LFS_TESTBD_TRACE("lfs_testbd_destroy -> %d", err);
         return err;
+    } else if (bd->persist) {
+        int err = lfs_mmapbd_destroy(cfg);
+        LFS_TESTBD_TRACE("lfs_testbd_destroy -> %d", err);
+        return err;
     } else {
         int err = lfs_rambd_destroy(cfg);
         LFS_TESTBD_TRACE("lfs_testbd_destroy -> %d", err);
@@ -106,8 +128,10 @@ int lfs_testbd_destroy(const struct lfs_config *cfg) {
 static int lfs_testbd_rawread(const struct lfs_config *cfg, lfs_block_t block,
         lfs_off_t off, void *buffer, lfs_size_t size) {
     lfs_testbd_t *bd = cfg->context;
-    if (bd->persist) {
+    if (bd->persist && bd->cfg->filebd) {
         return lfs_filebd_read(cfg, block, off, buffer, size);
+    } else if (bd->persist) {
+        return lfs_mmapbd_read(cfg, block, off, buffer, size);
     } else {
         return lfs_rambd_read(cfg, block, off, buffer, size);
     }
@@ -116,8 +140,10 @@ static int lfs_testbd_rawread(const struct lfs_config *cfg, lfs_block_t block,
 static int lfs_testbd_rawprog(const struct lfs_config *cfg, lfs_block_t block,
         lfs_off_t off, const void *buffer, lfs_size_t size) {
     lfs_testbd_t *bd = cfg->context;
-    if (bd->persist) {
+    if (bd->persist && bd->cfg->filebd) {
         return lfs_filebd_prog(cfg, block, off, buffer, size);
+    } else if (bd->persist) {
+        return lfs_mmapbd_prog(cfg, block, off, buffer, size);
     } else {
         return lfs_rambd_prog(cfg, block, off, buffer, size);
     }
@@ -126,8 +152,10 @@ static int lfs_testbd_rawprog(const struct lfs_config *cfg, lfs_block_t block,
 static int lfs_testbd_rawerase(const struct lfs_config *cfg,
         lfs_block_t block) {
     lfs_testbd_t *bd = cfg->context;
-    if (bd->persist) {
+    if (bd->persist && bd->cfg->filebd) {
         return lfs_filebd_erase(cfg, block);
+    } else if (bd->persist) {
+        return lfs_mmapbd_erase(cfg, block);
     } else {
         return lfs_rambd_erase(cfg, block);
     }
@@ -135,13 +163,54 @@ static int lfs_testbd_rawerase(const struct lfs_config *cfg,
 
 static int lfs_testbd_rawsync(const struct lfs_config *cfg) {
     lfs_testbd_t *bd = cfg->context;
-    if (bd->persist) {
+    if (bd->persist && bd->cfg->filebd) {
         return lfs_filebd_sync(cfg);
+    } else if (bd->persist) {
+        return lfs_mmapbd_sync(cfg);
     } else {
         return lfs_rambd_sync(cfg);
     }
 }
 
+/// Simulated timing ///
+static void lfs_testbd_tick(const struct lfs_config *cfg, uint8_t op,
+        lfs_block_t block, lfs_off_t off, lfs_size_t size) {
+    lfs_testbd_t *bd = cfg->context;
+    const struct lfs_testbd_timing *timing = bd->cfg->timing;
+    if (!timing) {
+        return;
+    }
+
+    uint64_t pos = (uint64_t)block*cfg->block_size + off;
+    lfs_size_t sector_size = lfs_max(timing->sector_size, 1);
+    lfs_size_t sectors = (size + sector_size-1) / sector_size;
+    bool cont = (op == bd->time_op && pos == bd->time_pos);
+
+    if (op == LFS_TESTBD_OP_READ) {
+        bd->time += cont ? timing->continue_overhead : timing->read_overhead;
+        bd->time += (lfs_testbd_time_t)sectors * timing->read_sector;
+    } else if (op == LFS_TESTBD_OP_PROG) {
+        bd->time += cont ? timing->continue_overhead : timing->prog_overhead;
+        bd->time += (lfs_testbd_time_t)sectors * timing->prog_sector;
+
+        // stall for garbage collection?
+        if (timing->gc_interval) {
+            bd->time_gc += sectors;
+            while (bd->time_gc >= timing->gc_interval) {
+                bd->time += timing->gc_stall;
+                bd->time_gc -= timing->gc_interval;
+            }
+        }
+    } else if (op == LFS_TESTBD_OP_ERASE) {
+        bd->time += timing->erase_overhead;
+    } else {
+        bd->time += timing->sync;
+    }
+
+    bd->time_op = op;
+    bd->time_pos = pos + size;
+}
+
 /// block device API ///
 int lfs_testbd_read(const struct lfs_config *cfg, lfs_block_t block,
         lfs_off_t off, void *buffer, lfs_size_t size) {
@@ -163,6 +232,7 @@ int lfs_testbd_read(const struct lfs_config *cfg, lfs_block_t block,
     }
 
     // read
+    lfs_testbd_tick(cfg, LFS_TESTBD_OP_READ, block, off, size);
     int err = lfs_testbd_rawread(cfg, block, off, buffer, size);
     LFS_TESTBD_TRACE("lfs_testbd_read -> %d", err);
     return err;
@@ -196,6 +266,7 @@ int lfs_testbd_prog(const struct lfs_config *cfg, lfs_block_t block,
     }
 
     // prog
+    lfs_testbd_tick(cfg, LFS_TESTBD_OP_PROG, block, off, size);
     int err = lfs_testbd_rawprog(cfg, block, off, buffer, size);
     if (err) {
         LFS_TESTBD_TRACE("lfs_testbd_prog -> %d", err);
@@ -243,6 +314,7 @@ int lfs_testbd_erase(const struct lfs_config *cfg, lfs_block_t block) {
     }
 
     // erase
+    lfs_testbd_tick(cfg, LFS_TESTBD_OP_ERASE, block, 0, 0);
     int err = lfs_testbd_rawerase(cfg, block);
     if (err) {
         LFS_TESTBD_TRACE("lfs_testbd_erase -> %d", err);
@@ -266,6 +338,7 @@ int lfs_testbd_erase(const struct lfs_config *cfg, lfs_block_t block) {
 
 int lfs_testbd_sync(const struct lfs_config *cfg) {
     LFS_TESTBD_TRACE("lfs_testbd_sync(%p)", (void*)cfg);
+    lfs_testbd_tick(cfg, LFS_TESTBD_OP_SYNC, 0, 0, 0);
     int err = lfs_testbd_rawsync(cfg);
     LFS_TESTBD_TRACE("lfs_testbd_sync -> %d", err);
     return err;
@@ -300,3 +373,29 @@ int lfs_testbd_setwear(const struct lfs_config *cfg,
     LFS_TESTBD_TRACE("lfs_testbd_setwear -> %d", 0);
     return 0;
 }
+
+
+/// simulated timing operations ///
+lfs_testbd_time_t lfs_testbd_gettime(const struct lfs_config *cfg) {
+    LFS_TESTBD_TRACE("lfs_testbd_gettime(%p)", (void*)cfg);
+    lfs_testbd_t *bd = cfg->context;
+
+    // check if timing is enabled
+    LFS_ASSERT(bd->cfg->timing);
+
+    LFS_TESTBD_TRACE("lfs_testbd_gettime -> %"PRIu64, bd->time);
+    return bd->time;
+}
+
+int lfs_testbd_settime(const struct lfs_config *cfg, lfs_testbd_time_t time) {
+    LFS_TESTBD_TRACE("lfs_testbd_settime(%p, %"PRIu64")", (void*)cfg, time);
+    lfs_testbd_t *bd = cfg->context;
+
+    // check if timing is enabled
+    LFS_ASSERT(bd->cfg->timing);
+
+    bd->time = time;
+
+    LFS_TESTBD_TRACE("lfs_testbd_settime -> %d", 0);
+    return 0;
+}
@@ -1,6 +1,6 @@
 /*
- * Testing block device, wraps filebd and rambd while providing a bunch
- * of hooks for testing littlefs in various conditions.
+ * Testing block device, wraps mmapbd, filebd and rambd while providing a
+ * bunch of hooks for testing littlefs in various conditions.
  *
  * Copyright (c) 2017, Arm Limited. All rights reserved.
  * SPDX-License-Identifier: BSD-3-Clause
@@ -11,6 +11,7 @@
 #include "lfs.h"
 #include "lfs_util.h"
 #include "bd/lfs_rambd.h"
+#include "bd/lfs_mmapbd.h"
 #include "bd/lfs_filebd.h"
 
 #ifdef __cplusplus
@@ -44,6 +45,39 @@ enum lfs_testbd_badblock_behavior {
 typedef uint32_t lfs_testbd_wear_t;
 typedef int32_t  lfs_testbd_swear_t;
 
+// Type for measuring simulated time, in nanoseconds
+typedef uint64_t lfs_testbd_time_t;
+
+// Timing model for simulating the latency of a block device such as an SD
+// card. All times are in nanoseconds of simulated time.
+struct lfs_testbd_timing {
+    // Cost of issuing a command, paid once per read/prog/erase
+    uint32_t read_overhead;
+    uint32_t prog_overhead;
+    uint32_t erase_overhead;
+
+    // Cost of issuing a read/prog that continues exactly where the previous
+    // command of the same kind stopped. This models multi-block transfers,
+    // set this to the normal overhead to disable the discount.
+    uint32_t continue_overhead;
+
+    // Size of a transfer unit in bytes, reads and progs are rounded up to
+    // whole sectors. 0 is treated as 1.
+    lfs_size_t sector_size;
+
+    // Cost of transferring a sector
+    uint32_t read_sector;
+    uint32_t prog_sector;
+
+    // Simulated FTL garbage collection, every gc_interval progged sectors
+    // the device stalls for gc_stall. 0 disables.
+    uint32_t gc_interval;
+    uint32_t gc_stall;
+
+    // Cost of a sync
+    uint32_t sync;
+};
+
 // testbd config, this is required for testing
 struct lfs_testbd_config {
     // 8-bit erase value to use for simulating erases. -1 does not simulate
@@ -67,11 +101,24 @@ struct lfs_testbd_config {
 
     // Optional buffer for wear
     void *wear_buffer;
+
+    // Optional timing model, if provided testbd accumulates simulated time
+    // for each operation. See lfs_testbd_gettime.
+    const struct lfs_testbd_timing *timing;
+
+    // Optional filebd config, if provided a persistent disk is accessed
+    // through filebd instead of mmapbd. The erase_value is taken from the
+    // testbd config. Ignored if no path is given.
+    const struct lfs_filebd_config *filebd;
 };
 
 // testbd state
 typedef struct lfs_testbd {
     union {
+        struct {
+            lfs_mmapbd_t bd;
+            struct lfs_mmapbd_config cfg;
+        } mmap;
         struct {
             lfs_filebd_t bd;
             struct lfs_filebd_config cfg;
@@ -86,6 +133,11 @@ typedef struct lfs_testbd {
     uint32_t power_cycles;
     lfs_testbd_wear_t *wear;
 
+    lfs_testbd_time_t time;
+    uint8_t time_op;
+    uint64_t time_pos;
+    uint32_t time_gc;
+
     const struct lfs_testbd_config *cfg;
 } lfs_testbd_t;
 
@@ -94,8 +146,8 @@ typedef struct lfs_testbd {
 
 // Create a test block device using the geometry in lfs_config
 //
-// Note that filebd is used if a path is provided, if path is NULL
-// testbd will use rambd which can be much faster.
+// Note that mmapbd, or filebd if configured, is used if a path is provided,
+// if path is NULL testbd will use rambd which can be much faster.
 int lfs_testbd_create(const struct lfs_config *cfg, const char *path);
 int lfs_testbd_createcfg(const struct lfs_config *cfg, const char *path,
         const struct lfs_testbd_config *bdcfg);
@@ -133,6 +185,12 @@ lfs_testbd_swear_t lfs_testbd_getwear(const struct lfs_config *cfg,
 int lfs_testbd_setwear(const struct lfs_config *cfg,
         lfs_block_t block, lfs_testbd_wear_t wear);
 
+// Get simulated time spent in the block device
+lfs_testbd_time_t lfs_testbd_gettime(const struct lfs_config *cfg);
+
+// Manually set simulated time, for example to measure a single operation
+int lfs_testbd_settime(const struct lfs_config *cfg, lfs_testbd_time_t time);
+
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -29,7 +29,13 @@ extern "C"
 // Version of On-disk data structures
 // Major (top-nibble), incremented on backwards incompatible changes
 // Minor (bottom-nibble), incremented on feature additions
-#define LFS_DISK_VERSION 0x00020000
+//
+// Minor versions with the top bit set are this port's own extensions, kept
+// clear of upstream's minor versions, which count up from 0. New images are
+// formatted as v2.0, and only claim v2.0x8000 once they store a file as
+// extents or a fragment, which upstream drivers can't read and so refuse to
+// mount. Upstream minor versions past 2.0 are refused here in turn.
+#define LFS_DISK_VERSION 0x00028000
 #define LFS_DISK_VERSION_MAJOR (0xffff & (LFS_DISK_VERSION >> 16))
 #define LFS_DISK_VERSION_MINOR (0xffff & (LFS_DISK_VERSION >>  0))
 
@@ -67,6 +73,19 @@ typedef uint32_t lfs_block_t;
 #define LFS_ATTR_MAX 1022
 #endif
 
+// Maximum number of pending metadata attributes in a transaction, may be
+// redefined to change the size of the transaction struct. Each operation in
+// a transaction consumes between 1 and 5 attributes.
+#ifndef LFS_TX_MAX
+#define LFS_TX_MAX 64
+#endif
+
+// Maximum number of files lfs_fs_sync commits together, may be redefined to
+// trade stack for fewer commits when many open files share a metadata pair.
+#ifndef LFS_SYNC_MAX
+#define LFS_SYNC_MAX 8
+#endif
+
 // Possible error codes, these are negative to allow
 // valid positive return values
 enum lfs_error {
@@ -110,6 +129,8 @@ enum lfs_type {
     LFS_TYPE_DIRSTRUCT      = 0x200,
     LFS_TYPE_CTZSTRUCT      = 0x202,
     LFS_TYPE_INLINESTRUCT   = 0x201,
+    LFS_TYPE_EXTSTRUCT      = 0x203,
+    LFS_TYPE_FRAGSTRUCT     = 0x204,
     LFS_TYPE_SOFTTAIL       = 0x600,
     LFS_TYPE_HARDTAIL       = 0x601,
     LFS_TYPE_MOVESTATE      = 0x7ff,
@@ -131,7 +152,9 @@ enum lfs_open_flags {
     LFS_O_EXCL   = 0x0200,    // Fail if a file already exists
     LFS_O_TRUNC  = 0x0400,    // Truncate the existing file to zero size
     LFS_O_APPEND = 0x0800,    // Move to end of file on every write
+    LFS_O_LOG    = 0x2000,    // Append into the last block in place, if safe
 #endif
+    LFS_O_DIRECT = 0x1000,    // Move aligned data straight to/from the buffer
 
     // internally used flags
 #ifndef LFS_READONLY
@@ -143,6 +166,7 @@ enum lfs_open_flags {
     LFS_F_ERRED   = 0x080000, // An error occurred during write
 #endif
     LFS_F_INLINE  = 0x100000, // Currently inlined in directory entry
+    LFS_F_EXTENT  = 0x200000, // Currently stored as a list of extents
 };
 
 // File seek flags
@@ -153,6 +177,16 @@ enum lfs_whence_flags {
 };
 
 
+// Verification policies, how much of what is programmed is read back to
+// catch bad blocks
+enum lfs_verify {
+    LFS_VERIFY_DEFAULT  = 0, // Always, or the filesystem's policy for files
+    LFS_VERIFY_ALWAYS   = 1, // Read back metadata and file data
+    LFS_VERIFY_METADATA = 2, // Read back metadata only
+    LFS_VERIFY_SAMPLED  = 3, // Metadata, and some of the file data flushes
+    LFS_VERIFY_NEVER    = 4, // Trust the block device to report errors
+};
+
 // Configuration provided during initialization of the littlefs
 struct lfs_config {
     // Opaque user provided context that can be used to pass
@@ -262,6 +296,78 @@ struct lfs_config {
     // can help bound the metadata compaction time. Must be <= block_size.
     // Defaults to block_size when zero.
     lfs_size_t metadata_max;
+
+    // Optional policy for reading back what is programmed, see enum
+    // lfs_verify. Devices with their own ECC and bad block management, such
+    // as SD cards, may not need file data read back. Without read back, bad
+    // blocks are only found if prog returns LFS_ERR_CORRUPT. Defaults to
+    // LFS_VERIFY_ALWAYS when zero.
+    uint8_t verify;
+
+    // Optional number of file data progs that reach the block device per
+    // prog that is read back with LFS_VERIFY_SAMPLED. Defaults to 16 when
+    // zero.
+    lfs_size_t verify_interval;
+
+    // Optional size of a scratch buffer in bytes, used to compact metadata
+    // pairs in one pass over their logs instead of rescanning the rest of
+    // the log for every tag. Each tag that may be kept needs 12 bytes, and
+    // each id 2 bytes. Logs that don't fit fall back to rescanning. Zero
+    // disables the scratch buffer.
+    lfs_size_t compact_size;
+
+    // Optional statically allocated compaction buffer. Must be compact_size
+    // and aligned to a 32-bit boundary. By default lfs_malloc is used to
+    // allocate this buffer.
+    void *compact_buffer;
+
+    // Optional size of a buffer in bytes that indexes the live tags of the
+    // last metadata pair fetched, so repeated lookups in the same pair don't
+    // walk its log again. Each tag needs 12 bytes, and each id 2
+    // bytes. Pairs that don't fit are walked as usual. Zero disables the
+    // index.
+    lfs_size_t index_size;
+
+    // Optional statically allocated index buffer. Must be index_size and
+    // aligned to a 32-bit boundary. By default lfs_malloc is used to
+    // allocate this buffer.
+    void *index_buffer;
+
+    // Optional size of a buffer in bytes that remembers the parent and
+    // predecessor of each metadata pair, so relocations and deorphaning
+    // don't walk the whole filesystem to find them. It's built with one
+    // walk on first use and kept up to date after that. What it remembers
+    // is checked on disk before it's trusted, so a stale entry only costs
+    // another walk. Each pair needs 24 bytes. Zero disables the index.
+    lfs_size_t parent_size;
+
+    // Optional statically allocated parent index buffer. Must be
+    // parent_size and aligned to a 32-bit boundary. By default lfs_malloc
+    // is used to allocate this buffer.
+    void *parent_buffer;
+
+    // Optional size in bytes of the largest file packed into a data block
+    // shared with other small files, instead of taking a whole block of its
+    // own. Files too big to inline in their metadata but no bigger than this
+    // are kept in the file's cache and written out as a fragment when
+    // synced. Must be <= cache_size. Zero disables packing.
+    lfs_size_t pack_max;
+
+    // Optional number of file buffers set aside at mount. Files opened
+    // without a buffer of their own take one from this pool if their cache
+    // fits, and only fall back to lfs_malloc when the pool runs out. Zero
+    // disables the pool.
+    lfs_size_t file_pool_count;
+
+    // Size of each buffer in the file pool. Must be a multiple of the read
+    // and program sizes, and a factor of the block size. Defaults to
+    // cache_size when zero.
+    lfs_size_t file_pool_size;
+
+    // Optional statically allocated file pool. Must be file_pool_count *
+    // file_pool_size bytes. By default lfs_malloc is used to allocate this
+    // buffer.
+    void *file_pool_buffer;
 };
 
 // File info structure
@@ -272,6 +378,16 @@ struct lfs_info {
     // Size of the file, only valid for REG files. Limited to 32-bits.
     lfs_size_t size;
 
+    // Number of blocks holding the file's data, only valid for REG files.
+    // Inline files are stored in their directory and take up no blocks.
+    lfs_size_t blocks;
+
+    // Hash of the metadata pair and id the entry is stored at. It changes
+    // whenever the entry moves, such as when entries before it are created
+    // or removed, or its metadata pair is relocated, and different entries
+    // may hash the same, so it is not a stable inode number.
+    uint32_t ino;
+
     // Name of the file stored as a null-terminated string. Limited to
     // LFS_NAME_MAX+1, which can be changed by redefining LFS_NAME_MAX to
     // reduce RAM. LFS_NAME_MAX is stored in superblock and must be
@@ -279,6 +395,26 @@ struct lfs_info {
     char name[LFS_NAME_MAX+1];
 };
 
+// Block structure, describes a block found by lfs_fs_traverseinfo
+struct lfs_fsblock {
+    // Address of the block
+    lfs_block_t block;
+
+    // What refers to the block. LFS_TYPE_DIR for a block of a metadata pair,
+    // LFS_TYPE_HARDTAIL or LFS_TYPE_SOFTTAIL for the pair it continues in,
+    // LFS_TYPE_DIRSTRUCT for the pair of a directory, and
+    // LFS_TYPE_CTZSTRUCT, LFS_TYPE_EXTSTRUCT or LFS_TYPE_FRAGSTRUCT for a
+    // file's data. Fragment blocks may be shared by several files.
+    uint16_t type;
+
+    // Id of the entry referring to the block, 0x3ff for the pair itself
+    // and its tail
+    uint16_t id;
+
+    // Metadata pair holding the reference
+    lfs_block_t pair[2];
+};
+
 // Custom attribute structure, used to describe custom attributes
 // committed atomically during file writes.
 struct lfs_attr {
@@ -293,12 +429,29 @@ struct lfs_attr {
     lfs_size_t size;
 };
 
+// Extent structure, describes a run of contiguous blocks in a file
+struct lfs_extent {
+    // First block in the run
+    lfs_block_t block;
+
+    // Number of blocks in the run
+    lfs_size_t count;
+};
+
 // Optional configuration provided during lfs_file_opencfg
 struct lfs_file_config {
-    // Optional statically allocated file buffer. Must be cache_size.
-    // By default lfs_malloc is used to allocate this buffer.
+    // Optional statically allocated file buffer. Must be the file's cache
+    // size. By default the buffer comes from the file pool, or lfs_malloc
+    // if the pool is empty.
     void *buffer;
 
+    // Optional size of this file's cache in bytes, for example large for
+    // streaming writers or small for short reads. Must be a multiple of the
+    // read and program sizes, and a factor of the block size. Inline and
+    // packed files are limited to what fits in the cache. Defaults to
+    // cache_size in lfs_config when zero.
+    lfs_size_t cache_size;
+
     // Optional list of custom attributes related to the file. If the file
     // is opened with read access, these attributes will be read from disk
     // during the open call. If the file is opened with write access, the
@@ -314,6 +467,31 @@ struct lfs_file_config {
 
     // Number of custom attributes in the list
     lfs_size_t attr_count;
+
+    // Optional buffer of extents. If provided, a file that outgrows its
+    // inline entry is stored as a list of runs of contiguous blocks instead
+    // of a CTZ skip-list. This suits large, mostly-append files, reads and
+    // writes become sequential and traversals don't need to read the file.
+    //
+    // Extent files can only be appended to. Writing anywhere else, or
+    // running out of extents, converts the file back into a CTZ skip-list,
+    // which requires copying the file. Extent files opened without a large
+    // enough buffer can still be read.
+    struct lfs_extent *extents;
+
+    // Number of extents in the extent buffer. The number of extents in a
+    // file is also limited to what fits in the cache and in a metadata entry.
+    lfs_size_t extent_count;
+
+    // Optional policy for reading back this file's data, see enum
+    // lfs_verify. Defaults to the policy in lfs_config when zero.
+    uint8_t verify;
+
+    // Optional check, made on every read and write of a file opened with
+    // LFS_O_DIRECT, of whether the user's buffer may be handed straight to
+    // the block device, for example whether DMA can reach it. Other buffers
+    // go through the file's cache. NULL accepts every buffer.
+    bool (*direct)(const void *buffer);
 };
 
 
@@ -322,6 +500,7 @@ typedef struct lfs_cache {
     lfs_block_t block;
     lfs_off_t off;
     lfs_size_t size;
+    lfs_size_t buffer_size;
     uint8_t *buffer;
 } lfs_cache_t;
 
@@ -347,6 +526,15 @@ typedef struct lfs_dir {
     lfs_block_t head[2];
 } lfs_dir_t;
 
+// littlefs directory cursor, a position saved from a directory
+typedef struct lfs_dir_cursor {
+    lfs_block_t head[2];
+    lfs_block_t pair[2];
+    uint32_t rev;
+    uint16_t id;
+    lfs_off_t pos;
+} lfs_dir_cursor_t;
+
 // littlefs file type
 typedef struct lfs_file {
     struct lfs_file *next;
@@ -359,15 +547,34 @@ typedef struct lfs_file {
         lfs_size_t size;
     } ctz;
 
+    struct lfs_frag {
+        lfs_size_t size;
+        lfs_block_t block;
+        lfs_off_t off;
+    } frag;
+
     uint32_t flags;
     lfs_off_t pos;
     lfs_block_t block;
     lfs_off_t off;
     lfs_cache_t cache;
+    lfs_size_t ecount;
 
     const struct lfs_file_config *cfg;
 } lfs_file_t;
 
+struct lfs_mattr {
+    uint32_t tag;
+    const void *buffer;
+};
+
+// littlefs transaction type
+typedef struct lfs_tx {
+    lfs_mdir_t m;
+    uint16_t count;
+    struct lfs_mattr attrs[LFS_TX_MAX];
+} lfs_tx_t;
+
 typedef struct lfs_superblock {
     uint32_t version;
     lfs_size_t block_size;
@@ -395,6 +602,47 @@ typedef struct lfs {
         lfs_mdir_t m;
     } *mlist;
     uint32_t seed;
+    bool defersync;
+    uint32_t verify_count;
+
+    struct lfs_compact {
+        uint32_t *buffer;
+        bool busy;
+    } compact;
+
+    struct lfs_index {
+        lfs_block_t block;
+        uint32_t rev;
+        lfs_off_t off;
+        uint32_t ptag;
+        uint16_t ids;
+        uint16_t count;
+        uint16_t pending;
+        bool overflow;
+        uint32_t *buffer;
+    } index;
+
+    struct lfs_parents {
+        uint32_t *buffer;
+        lfs_size_t count;
+        bool valid;
+        bool full;
+    } parents;
+
+    struct lfs_pack {
+        lfs_block_t block;
+        lfs_off_t off;
+    } pack;
+
+    struct lfs_logtail {
+        lfs_block_t block;
+        lfs_off_t off;
+    } logtail;
+
+    struct lfs_pool {
+        uint8_t *buffer;
+        void *free;
+    } pool;
 
     lfs_gstate_t gstate;
     lfs_gstate_t gdisk;
@@ -409,6 +657,7 @@ typedef struct lfs {
     } free;
 
     const struct lfs_config *cfg;
+    uint32_t disk_version;
     lfs_size_t name_max;
     lfs_size_t file_max;
     lfs_size_t attr_max;
@@ -600,6 +849,13 @@ int lfs_file_rewind(lfs_t *lfs, lfs_file_t *file);
 // Returns the size of the file, or a negative error code on failure.
 lfs_soff_t lfs_file_size(lfs_t *lfs, lfs_file_t *file);
 
+// Find info about an open file
+//
+// Like lfs_stat, but without looking up a path, and the size includes
+// data not yet synced.
+// Returns a negative error code on failure.
+int lfs_file_stat(lfs_t *lfs, lfs_file_t *file, struct lfs_info *info);
+
 
 /// Directory operations ///
 
@@ -629,6 +885,15 @@ int lfs_dir_close(lfs_t *lfs, lfs_dir_t *dir);
 // or a negative error code on failure.
 int lfs_dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info);
 
+// Read a batch of entries in the directory
+//
+// Fills out up to count info structures, decoding the entries of each
+// metadata pair in one pass instead of one pass per entry. Returns the
+// number of entries read, 0 at the end of directory, or a negative error
+// code on failure.
+int lfs_dir_readbatch(lfs_t *lfs, lfs_dir_t *dir,
+        struct lfs_info *info, lfs_size_t count);
+
 // Change the position of the directory
 //
 // The new off must be a value previous returned from tell and specifies
@@ -650,13 +915,94 @@ lfs_soff_t lfs_dir_tell(lfs_t *lfs, lfs_dir_t *dir);
 // Returns a negative error code on failure.
 int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir);
 
+// Save the position of the directory in a cursor
+//
+// The cursor records the metadata pair and entry the directory is at, so
+// seeking back to it does not walk the directory from the beginning.
+//
+// Returns a negative error code on failure.
+int lfs_dir_tellcursor(lfs_t *lfs, lfs_dir_t *dir, lfs_dir_cursor_t *cursor);
+
+// Change the position of the directory to a saved cursor
+//
+// The cursor must come from tellcursor on the same directory. Like offsets
+// from tell, entries created or removed since may be skipped or repeated.
+// If the metadata pair has since been compacted, relocated or dropped, or
+// the cursor is from another directory, this falls back to seeking to the
+// cursor's offset, walking the directory from the beginning.
+//
+// Returns a negative error code on failure.
+int lfs_dir_seekcursor(lfs_t *lfs, lfs_dir_t *dir,
+        const lfs_dir_cursor_t *cursor);
+
+
+/// Transaction operations ///
+
+#ifndef LFS_READONLY
+// Begin a transaction
+//
+// A transaction collects create, remove, rename and setattr operations on
+// entries in the same metadata pair and writes them out as a single metadata
+// commit in lfs_tx_commit, so either all or none of them survive power-loss.
+// Operations see the results of earlier operations in the same transaction.
+//
+// A small directory is one metadata pair, but a large directory may have
+// been split over several. An operation on an entry in a different metadata
+// pair than the pending operations fails with LFS_ERR_INVAL, commit and
+// begin a new transaction to continue.
+//
+// Paths and attribute buffers must stay valid until lfs_tx_commit. The
+// directory must not be modified outside of the transaction while it is
+// pending. A transaction holds no resources, to discard a transaction
+// simply don't commit it.
+//
+// Returns a negative error code on failure.
+int lfs_tx_begin(lfs_t *lfs, lfs_tx_t *tx);
+
+// Create an empty file as a part of a transaction
+//
+// Returns a negative error code on failure.
+int lfs_tx_create(lfs_t *lfs, lfs_tx_t *tx, const char *path);
+
+// Remove a file as a part of a transaction
+//
+// Removing directories is not supported in transactions.
+// Returns a negative error code on failure.
+int lfs_tx_remove(lfs_t *lfs, lfs_tx_t *tx, const char *path);
+
+// Rename or move a file or directory as a part of a transaction
+//
+// The new path must be in the same metadata pair as the old path, and the
+// old path must not have been created or modified earlier in the same
+// transaction. If the destination exists, it must be a file.
+//
+// Returns a negative error code on failure.
+int lfs_tx_rename(lfs_t *lfs, lfs_tx_t *tx,
+        const char *oldpath, const char *newpath);
+
+// Set a custom attribute as a part of a transaction
+//
+// Returns a negative error code on failure.
+int lfs_tx_setattr(lfs_t *lfs, lfs_tx_t *tx, const char *path,
+        uint8_t type, const void *buffer, lfs_size_t size);
+
+// Commit a transaction
+//
+// Writes out all pending operations in one commit. The transaction is empty
+// after the commit, even on failure.
+//
+// Returns a negative error code on failure.
+int lfs_tx_commit(lfs_t *lfs, lfs_tx_t *tx);
+#endif
+
 
 /// Filesystem-level filesystem operations
 
 // Finds the current size of the filesystem
 //
-// Note: Result is best effort. If files share COW structures, the returned
-// size may be larger than the filesystem actually is.
+// Blocks shared by several files or found more than once are counted once.
+// This takes one traversal per 8*lookahead_size blocks, and the allocator
+// rescans on its next allocation.
 //
 // Returns the number of allocated blocks, or a negative error code on failure.
 lfs_ssize_t lfs_fs_size(lfs_t *lfs);
@@ -670,6 +1016,31 @@ lfs_ssize_t lfs_fs_size(lfs_t *lfs);
 // Returns a negative error code on failure.
 int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void*, lfs_block_t), void *data);
 
+// Traverse through one metadata pair, describing each block
+//
+// Like lfs_fs_traverse, but only the given metadata pair is visited, along
+// with what it refers to, and open files are not visited. The metadata
+// list starts at the superblock pair {0, 1}, and each pair's tail, if it
+// has one, is described right after the pair's own blocks and before its
+// files. Several lfs_t mounted on the same unchanging block device can
+// split a traversal between threads by handing each tail on as soon as it
+// is found, so every pair is only fetched once.
+//
+// Returns a negative error code on failure.
+int lfs_fs_traverseinfo(lfs_t *lfs, const lfs_block_t pair[2],
+        int (*cb)(void*, const struct lfs_fsblock*), void *data);
+
+#ifndef LFS_READONLY
+// Synchronize all open files to storage
+//
+// Equivalent to calling lfs_file_sync on every open file, but files that
+// share a metadata pair are committed together, up to LFS_SYNC_MAX per
+// commit, and the block device is only synced once.
+//
+// Returns a negative error code on failure.
+int lfs_fs_sync(lfs_t *lfs);
+#endif
+
 #ifndef LFS_READONLY
 #ifdef LFS_MIGRATE
 // Attempts to migrate a previous version of littlefs
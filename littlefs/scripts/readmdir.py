@@ -17,6 +17,7 @@ TAG_TYPES = {
     'dirstruct':    (0x7ff, 0x200),
     'ctzstruct':    (0x7ff, 0x202),
     'inlinestruct': (0x7ff, 0x201),
+    'extstruct':    (0x7ff, 0x203),
     'userattr':     (0x700, 0x300),
     'tail':         (0x700, 0x600),
     'softtail':     (0x7ff, 0x600),
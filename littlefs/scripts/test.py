@@ -31,6 +31,10 @@ define FLATTEN
 endef
 $(foreach target,$(TESTSRC),$(eval $(FLATTEN)))
 
+# block devices may use host extensions, these need to be enabled before
+# explode_asserts' headers are included
+%(path)s.bd.%%.o: override CFLAGS += -D_GNU_SOURCE
+
 -include %(path)s*.d
 .SECONDARY:
 
@@ -84,6 +88,15 @@ DEFINES = {
     'LFS_ERASE_VALUE': 0xff,
     'LFS_ERASE_CYCLES': 0,
     'LFS_BADBLOCK_BEHAVIOR': 'LFS_TESTBD_BADBLOCK_PROGERROR',
+    'LFS_TIMING': 'NULL',
+    'LFS_VERIFY': 'LFS_VERIFY_DEFAULT',
+    'LFS_COMPACT_SIZE': 512,
+    'LFS_INDEX_SIZE': 2048,
+    'LFS_PARENT_SIZE': 4096,
+    'LFS_PACK_MAX': 0,
+    'LFS_FILEBD': 0,
+    'LFS_FILEBD_DIRECT': 0,
+    'LFS_FILEBD_PROG_BUFFER_SIZE': 0,
 }
 PROLOGUE = """
     // prologue
@@ -110,6 +123,16 @@ PROLOGUE = """
         .block_cycles   = LFS_BLOCK_CYCLES,
         .cache_size     = LFS_CACHE_SIZE,
         .lookahead_size = LFS_LOOKAHEAD_SIZE,
+        .verify         = LFS_VERIFY,
+        .compact_size   = LFS_COMPACT_SIZE,
+        .index_size     = LFS_INDEX_SIZE,
+        .parent_size    = LFS_PARENT_SIZE,
+        .pack_max       = LFS_PACK_MAX,
+    };
+
+    __attribute__((unused)) const struct lfs_filebd_config filebdcfg = {
+        .direct             = LFS_FILEBD_DIRECT,
+        .prog_buffer_size   = LFS_FILEBD_PROG_BUFFER_SIZE,
     };
 
     __attribute__((unused)) const struct lfs_testbd_config bdcfg = {
@@ -117,6 +140,8 @@ PROLOGUE = """
         .erase_cycles       = LFS_ERASE_CYCLES,
         .badblock_behavior  = LFS_BADBLOCK_BEHAVIOR,
         .power_cycles       = lfs_testbd_cycles,
+        .timing             = LFS_TIMING,
+        .filebd             = LFS_FILEBD ? &filebdcfg : NULL,
     };
 
     lfs_testbd_createcfg(&cfg, lfs_testbd_path, &bdcfg) => 0;
@@ -1,5 +1,7 @@
 #ifndef _VFS_LITTLEFS_H
 #define _VFS_LITTLEFS_H
+#include <stdbool.h>
+#include <stdint.h>
 #include "driver/sdmmc_defs.h"
 #include "driver/sdmmc_types.h"
 #include "driver/sdmmc_host.h"
@@ -9,17 +11,55 @@ struct lfs_config;
 struct lfs_config *lfs_setup_sdmmc(sdmmc_card_t *card);
 void lfs_setup_sdmmc_cleanup(struct lfs_config *c);
 
+/* geometry chosen for a card */
+struct lfs_sdmmc_tuning {
+    uint32_t au_size; // allocation unit from the SD status, 0 if unknown
+    uint32_t block_size;
+    uint32_t cache_size;
+    uint32_t lookahead_size;
+    uint32_t write_kbps; // probed throughput at block_size, 0 if not probed
+    uint32_t read_kbps; // probed throughput at cache_size, 0 if not probed
+};
+
+/* like lfs_setup_sdmmc, but block, cache and lookahead sizes are picked by
+ * benchmarking the card. With format the probe overwrites the first few MB
+ * of the card, otherwise the block size is a default that usually mounts */
+struct lfs_config *lfs_setup_sdmmc_tuned(sdmmc_card_t *card, bool format);
+/* like lfs_setup_sdmmc_tuned without format, but the block size is read from
+ * the superblock on the card, for when the default doesn't mount. NULL if
+ * there is no superblock */
+struct lfs_config *lfs_setup_sdmmc_stored(sdmmc_card_t *card);
+const struct lfs_sdmmc_tuning *lfs_sdmmc_tuning(const struct lfs_config *c);
+
 /* esp_lfs_fd.c: map integer <---> lfs_file_t */
 struct lfs_file;
+struct lfs_file_config;
 int esp_lfs_fd_new(void);
 struct lfs_file *esp_lfs_fd_file(int fd);
+/* cache_size 0 uses the mount's cache size, direct decides which buffers a
+ * file opened with LFS_O_DIRECT transfers straight to, NULL allows all,
+ * mtime loads the modification time at open, which dirties writable files */
+const struct lfs_file_config *esp_lfs_fd_config(int fd, uint32_t cache_size,
+        bool (*direct)(const void *buffer), bool mtime);
 int esp_lfs_fd_close(int fd);
+/* modification time of an open file, NULL without CONFIG_LFS_MTIME */
+int64_t *esp_lfs_fd_mtime(int fd);
+/* set the modification time of an open file to now, it's written with the
+ * file's next sync or close */
+void esp_lfs_fd_touch(int fd);
+
+/* custom attribute holding a file's modification time, as int64_t seconds
+ * since the epoch */
+#define ESP_LFS_ATTR_MTIME 0x74
 
 #define LFS_FLAG_FORMAT 1
+#define LFS_FLAG_AUTOTUNE 2 // use lfs_setup_sdmmc_tuned
 
 /* esp_lfs_vfs.c: mount fs and register VFS functions as backend to the POSIX API */
 int esp_vfs_littlefs_mount(const char* base_path, const struct lfs_config *cfg, int flags);
 int esp_vfs_littlefs_unmount(const char* base_path);
+/* like syncfs(2): write out all open files, one commit per metadata pair */
+int esp_vfs_littlefs_syncfs(const char* base_path);
 
 /* esp_lfs_mount.c: the one user-facing API */
 esp_err_t vfs_littlefs_sdmmc_mount(
@@ -29,6 +69,7 @@ esp_err_t vfs_littlefs_sdmmc_mount(
         int flags);
 
 #define vfs_littlefs_unmount esp_vfs_littlefs_unmount
+#define vfs_littlefs_syncfs esp_vfs_littlefs_syncfs
 
 #endif
 